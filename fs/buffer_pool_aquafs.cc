@@ -0,0 +1,124 @@
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "buffer_pool_aquafs.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+namespace aquafs {
+
+IOBuffer::IOBuffer(IOBuffer &&other) noexcept
+    : pool_(other.pool_),
+      data_(other.data_),
+      capacity_(other.capacity_),
+      size_class_(other.size_class_) {
+  other.pool_ = nullptr;
+  other.data_ = nullptr;
+  other.capacity_ = 0;
+  other.size_class_ = -1;
+}
+
+IOBuffer &IOBuffer::operator=(IOBuffer &&other) noexcept {
+  if (this != &other) {
+    Reset();
+    std::swap(pool_, other.pool_);
+    std::swap(data_, other.data_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(size_class_, other.size_class_);
+  }
+  return *this;
+}
+
+void IOBuffer::Reset() {
+  if (data_ == nullptr) return;
+  if (pool_ != nullptr && size_class_ >= 0)
+    pool_->Release(data_, size_class_);
+  else
+    free(data_);
+  pool_ = nullptr;
+  data_ = nullptr;
+  capacity_ = 0;
+  size_class_ = -1;
+}
+
+IOBufferPool::IOBufferPool(size_t alignment, bool hugepage)
+    : alignment_(alignment), hugepage_(hugepage) {}
+
+IOBufferPool::~IOBufferPool() {
+  for (auto &shard : shards_)
+    for (auto &list : shard.free)
+      for (auto buf : list) free(buf);
+}
+
+int IOBufferPool::SizeClass(size_t size) {
+  size_t class_size = kMinClassSize;
+  for (int c = 0; c < kNrClasses; c++, class_size <<= 1)
+    if (size <= class_size) return c;
+  return -1;
+}
+
+char *IOBufferPool::AllocateRaw(size_t size) {
+  bool huge = hugepage_ && size >= kHugePageSize;
+  char *buf = nullptr;
+  if (posix_memalign((void **)&buf,
+                     huge ? std::max(alignment_, kHugePageSize) : alignment_,
+                     size))
+    return nullptr;
+  if (huge) madvise(buf, size, MADV_HUGEPAGE);
+  return buf;
+}
+
+IOBufferPool::Shard &IOBufferPool::LocalShard() {
+  static std::atomic<size_t> next_shard{0};
+  static thread_local size_t shard = next_shard.fetch_add(1) % kNrShards;
+  return shards_[shard];
+}
+
+IOBuffer IOBufferPool::Allocate(size_t size) {
+  int size_class = SizeClass(size);
+  if (size_class < 0) {
+    /* Too large to be cached, round up to the alignment only */
+    size_t capacity = (size + alignment_ - 1) / alignment_ * alignment_;
+    char *buf = AllocateRaw(capacity);
+    if (buf == nullptr) return {};
+    return {this, buf, capacity, -1};
+  }
+
+  size_t capacity = kMinClassSize << size_class;
+  Shard &shard = LocalShard();
+  {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto &list = shard.free[size_class];
+    if (!list.empty()) {
+      char *buf = list.back();
+      list.pop_back();
+      return {this, buf, capacity, size_class};
+    }
+  }
+
+  char *buf = AllocateRaw(std::max(capacity, alignment_));
+  if (buf == nullptr) return {};
+  return {this, buf, capacity, size_class};
+}
+
+void IOBufferPool::Release(char *data, int size_class) {
+  size_t capacity = kMinClassSize << size_class;
+  size_t max_cached = std::max<size_t>(kShardClassBytes / capacity, 2);
+  Shard &shard = LocalShard();
+  {
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto &list = shard.free[size_class];
+    if (list.size() < max_cached) {
+      list.push_back(data);
+      return;
+    }
+  }
+  free(data);
+}
+
+}  // namespace aquafs
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
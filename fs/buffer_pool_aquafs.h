@@ -0,0 +1,84 @@
+#ifndef ROCKSDB_BUFFER_POOL_AQUAFS_H
+#define ROCKSDB_BUFFER_POOL_AQUAFS_H
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace aquafs {
+
+class IOBufferPool;
+
+/* Aligned I/O buffer borrowed from an IOBufferPool, given back on destruction */
+class IOBuffer {
+ public:
+  IOBuffer() = default;
+  IOBuffer(IOBuffer &&other) noexcept;
+  IOBuffer &operator=(IOBuffer &&other) noexcept;
+  IOBuffer(const IOBuffer &) = delete;
+  IOBuffer &operator=(const IOBuffer &) = delete;
+  ~IOBuffer() { Reset(); }
+
+  [[nodiscard]] char *data() const { return data_; }
+  [[nodiscard]] size_t capacity() const { return capacity_; }
+  explicit operator bool() const { return data_ != nullptr; }
+
+  void Reset();
+
+ private:
+  friend class IOBufferPool;
+
+  IOBuffer(IOBufferPool *pool, char *data, size_t capacity, int size_class)
+      : pool_(pool), data_(data), capacity_(capacity), size_class_(size_class) {}
+
+  IOBufferPool *pool_ = nullptr;
+  char *data_ = nullptr;
+  size_t capacity_ = 0;
+  int size_class_ = -1;
+};
+
+/*
+ * Pool of block aligned I/O buffers for metadata and migration I/O.
+ *
+ * Sizes are rounded up to power of two classes from kMinClassSize, released
+ * buffers are cached in a shard picked by the releasing thread, so threads
+ * mostly hit their own shard. Buffers above the largest class are not cached.
+ */
+class IOBufferPool {
+ public:
+  static constexpr size_t kMinClassSize = 4096;
+  static constexpr int kNrClasses = 11; /* 4K .. 4M */
+  static constexpr size_t kNrShards = 16;
+  /* Bytes of each size class a shard keeps */
+  static constexpr size_t kShardClassBytes = 8 << 20;
+  /* Buffers from this size up are backed by transparent hugepages */
+  static constexpr size_t kHugePageSize = 2 << 20;
+
+  explicit IOBufferPool(size_t alignment, bool hugepage = false);
+  ~IOBufferPool();
+
+  /* Returns an empty buffer if out of memory */
+  IOBuffer Allocate(size_t size);
+
+ private:
+  friend class IOBuffer;
+
+  struct alignas(64) Shard {
+    std::mutex mtx;
+    std::array<std::vector<char *>, kNrClasses> free;
+  };
+
+  size_t alignment_;
+  bool hugepage_;
+  std::array<Shard, kNrShards> shards_;
+
+  static int SizeClass(size_t size);
+  char *AllocateRaw(size_t size);
+  Shard &LocalShard();
+  void Release(char *data, int size_class);
+};
+
+}  // namespace aquafs
+
+#endif  // ROCKSDB_BUFFER_POOL_AQUAFS_H
@@ -6,4 +6,33 @@
 
 DEFINE_uint64(gc_start_level, 20, "Enable GC when percent < n%");
 DEFINE_uint64(gc_slope, 3, "GC aggressiveness");
-DEFINE_uint64(gc_sleep_time, 10 * 1000, "GC sleep time between running capacity detection");
\ No newline at end of file
+DEFINE_uint64(gc_sleep_time, 10 * 1000,
+              "Longest GC sleep time between capacity checks, the allocator "
+              "wakes GC up earlier when free space runs low");
+DEFINE_uint32(uring_depth, 64,
+              "Queue depth of the per-device io_uring engine, 0 to disable");
+DEFINE_uint64(readahead_min, 128 << 10,
+              "Initial readahead size once buffered reads turn sequential");
+DEFINE_uint64(readahead_max, 2 << 20,
+              "Maximum readahead size of buffered reads, 0 to disable");
+DEFINE_bool(io_buffer_hugepage, false,
+            "Back large metadata and migration buffers with hugepages");
+DEFINE_uint32(gc_threads, 2,
+              "Number of files GC migrates at once, each into its own zone");
+DEFINE_string(gc_policy, "greedy",
+              "GC victim selection: greedy, cost-benefit or lifetime");
+DEFINE_uint64(gc_min_rate, 64,
+              "GC migration rate in MB/s right below gc_start_level");
+DEFINE_uint64(gc_max_rate, 1024,
+              "GC migration rate in MB/s when nearly out of space, 0 for no "
+              "limit");
+DEFINE_bool(lifetime_learning, true,
+            "Place files by the lifetimes observed for their file class");
+DEFINE_uint32(lifetime_tolerance, 25,
+              "Predicted deaths within this percent of the lifetime share "
+              "zones");
+DEFINE_string(raid1_read_policy, "least-outstanding",
+              "Mirror picked by RAID1 reads: round-robin, least-outstanding "
+              "or split");
+DEFINE_uint64(raid1_split_min, 256 << 10,
+              "Smallest RAID1 read cut across mirrors by the split policy");
\ No newline at end of file
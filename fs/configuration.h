@@ -10,5 +10,17 @@
 DECLARE_uint64(gc_start_level);
 DECLARE_uint64(gc_slope);
 DECLARE_uint64(gc_sleep_time);
+DECLARE_uint32(uring_depth);
+DECLARE_uint64(readahead_min);
+DECLARE_uint64(readahead_max);
+DECLARE_bool(io_buffer_hugepage);
+DECLARE_uint32(gc_threads);
+DECLARE_string(gc_policy);
+DECLARE_uint64(gc_min_rate);
+DECLARE_uint64(gc_max_rate);
+DECLARE_bool(lifetime_learning);
+DECLARE_uint32(lifetime_tolerance);
+DECLARE_string(raid1_read_policy);
+DECLARE_uint64(raid1_split_min);
 
 #endif  // ROCKSDB_CONFIGURATION_H
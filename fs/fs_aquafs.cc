@@ -148,37 +148,51 @@ Status Superblock::CompatibleWith(ZonedBlockDevice *zbd) {
 }
 
 IOStatus AquaMetaLog::AddRecord(const Slice &slice) {
-  uint32_t record_sz = slice.size();
-  const char *data = slice.data();
-  size_t phys_sz;
-  uint32_t crc = 0;
-  char *buffer;
-  int ret;
-  IOStatus s;
+  return AddRecords(std::vector<Slice>{slice});
+}
 
-  phys_sz = record_sz + zMetaHeaderSize;
+IOStatus AquaMetaLog::AddRecords(const std::vector<Slice> &slices) {
+  size_t phys_sz = 0;
+  IOStatus s;
 
-  if (phys_sz % bs_) phys_sz += bs_ - phys_sz % bs_;
+  /* Every record is padded to a block, as ReadRecord expects */
+  for (const auto &slice : slices) {
+    size_t record_phys_sz = slice.size() + zMetaHeaderSize;
+    if (record_phys_sz % bs_) record_phys_sz += bs_ - record_phys_sz % bs_;
+    phys_sz += record_phys_sz;
+  }
 
-  assert(data != nullptr);
   assert((phys_sz % bs_) == 0);
+  if (phys_sz == 0) return IOStatus::OK();
 
-  ret = posix_memalign((void **)&buffer, sysconf(_SC_PAGESIZE), phys_sz);
-  if (ret) return IOStatus::IOError("Failed to allocate memory");
+  IOBuffer buffer = zbd_->GetBufferPool()->Allocate(phys_sz);
+  if (!buffer) return IOStatus::IOError("Failed to allocate memory");
 
-  memset(buffer, 0, phys_sz);
+  memset(buffer.data(), 0, phys_sz);
 
-  crc = crc32c::Extend(crc, (const char *)&record_sz, sizeof(uint32_t));
-  crc = crc32c::Extend(crc, data, record_sz);
-  crc = crc32c::Mask(crc);
+  char *p = buffer.data();
+  for (const auto &slice : slices) {
+    uint32_t record_sz = slice.size();
+    const char *data = slice.data();
+    uint32_t crc = 0;
 
-  EncodeFixed32(buffer, crc);
-  EncodeFixed32(buffer + sizeof(uint32_t), record_sz);
-  memcpy(buffer + sizeof(uint32_t) * 2, data, record_sz);
+    assert(data != nullptr);
 
-  s = zone_->Append(buffer, phys_sz);
+    crc = crc32c::Extend(crc, (const char *)&record_sz, sizeof(uint32_t));
+    crc = crc32c::Extend(crc, data, record_sz);
+    crc = crc32c::Mask(crc);
+
+    EncodeFixed32(p, crc);
+    EncodeFixed32(p + sizeof(uint32_t), record_sz);
+    memcpy(p + sizeof(uint32_t) * 2, data, record_sz);
+
+    size_t record_phys_sz = record_sz + zMetaHeaderSize;
+    if (record_phys_sz % bs_) record_phys_sz += bs_ - record_phys_sz % bs_;
+    p += record_phys_sz;
+  }
+
+  s = zone_->Append(buffer.data(), phys_sz);
 
-  free(buffer);
   return s;
 }
 
@@ -302,66 +316,232 @@ AquaFS::~AquaFS() {
 
   if (gc_worker_) {
     run_gc_worker_ = false;
+    zbd_->RequestGC(false);
     gc_worker_->join();
   }
 
+  {
+    std::lock_guard<std::mutex> lock(migrate_mtx_);
+    run_migrate_workers_ = false;
+  }
+  migrate_cv_.notify_all();
+  for (auto &t : migrate_workers_) t.join();
+
+  if (raid_convert_worker_) {
+    {
+      std::lock_guard<std::mutex> lock(raid_convert_mtx_);
+      run_raid_convert_worker_ = false;
+    }
+    raid_convert_cv_.notify_one();
+    raid_convert_worker_->join();
+  }
+
   meta_log_.reset(nullptr);
   ClearFiles();
   delete zbd_;
 }
 
 void AquaFS::GCWorker() {
+  bool busy = false;
   while (run_gc_worker_) {
-    usleep(1000 * FLAGS_gc_sleep_time);
+    /* Keep going while the previous cycle made progress, otherwise sleep
+     * until the allocator signals low space or the timeout expires */
+    bool urgent = false;
+    if (!busy)
+      urgent = zbd_->WaitForGCRequest(
+          std::chrono::milliseconds(FLAGS_gc_sleep_time));
+    busy = false;
+    if (!run_gc_worker_) break;
 
-    uint64_t non_free = zbd_->GetUsedSpace() + zbd_->GetReclaimableSpace();
-    uint64_t free = zbd_->GetFreeSpace();
-    uint64_t free_percent = (100 * free) / (free + non_free);
-    AquaFSSnapshot snapshot;
-    AquaFSSnapshotOptions options;
+    uint64_t free_percent = zbd_->GetFreePercent();
 
     if (free_percent > FLAGS_gc_start_level) continue;
 
-    options.zone_ = true;
-    options.zone_file_ = true;
-    options.log_garbage_ = true;
-
-    GetAquaFSSnapshot(snapshot, options);
+    /* Migrate faster the closer we are to running out of space */
+    gc_rate_.SetUrgency(
+        urgent ? 1.0
+               : static_cast<double>(FLAGS_gc_start_level - free_percent) /
+                     static_cast<double>(std::max<uint64_t>(
+                         FLAGS_gc_start_level, 1)));
 
     uint64_t threshold =
         (100 - FLAGS_gc_slope * (FLAGS_gc_start_level - free_percent));
+    std::vector<GCZoneStats> candidates;
+    zbd_->GetGCZoneStats(&candidates);
+    candidates.erase(
+        std::remove_if(candidates.begin(), candidates.end(),
+                       [&](const GCZoneStats &zone) {
+                         uint64_t garbage_percent_approx =
+                             100 - 100 * zone.used_capacity / zone.max_capacity;
+                         return garbage_percent_approx <= threshold ||
+                                garbage_percent_approx >= 100;
+                       }),
+        candidates.end());
+    if (candidates.empty()) continue;
+
+    /* Take the best ranked zones until free space is back above the start
+     * level, so a cycle moves as little live data as it can */
+    gc_policy_->Rank(candidates);
+    uint64_t total = zbd_->GetFreeSpace() + zbd_->GetUsedSpace() +
+                     zbd_->GetReclaimableSpace();
+    uint64_t target = total * (FLAGS_gc_start_level + 1 - free_percent) / 100;
+    uint64_t reclaimed = 0;
     std::set<uint64_t> migrate_zones_start;
-    for (const auto &zone : snapshot.zones_) {
-      if (zone.capacity == 0) {
-        uint64_t garbage_percent_approx =
-            100 - 100 * zone.used_capacity / zone.max_capacity;
-        if (garbage_percent_approx > threshold &&
-            garbage_percent_approx < 100) {
-          migrate_zones_start.emplace(zone.start);
-        }
+    for (const auto &zone : candidates) {
+      if (reclaimed >= target) break;
+      migrate_zones_start.emplace(zone.start);
+      reclaimed += zone.garbage();
+    }
+
+    /* Gather the live extents of the victims from the zone reverse index */
+    std::unordered_map<ZoneFile *, MigrateTask> file_tasks;
+    size_t nr_extents = 0;
+    for (auto start : migrate_zones_start) {
+      Zone *zone = zbd_->GetIOZone(start);
+      if (zone == nullptr) continue;
+      std::vector<ZoneLiveExtent> live;
+      zone->GetLiveExtents(&live);
+      for (auto &ext : live) {
+        auto &task = file_tasks[ext.file.get()];
+        task.file = std::move(ext.file);
+        task.extents[ext.start] = ext.length;
+        nr_extents++;
       }
     }
 
-    std::vector<ZoneExtentSnapshot *> migrate_exts;
-    for (auto &ext : snapshot.extents_) {
-      if (migrate_zones_start.find(ext.zone_start) !=
-          migrate_zones_start.end()) {
-        migrate_exts.push_back(&ext);
+    std::vector<MigrateTask> tasks;
+    {
+      /* Names can change under rename */
+      std::lock_guard<std::mutex> lock(files_mtx_);
+      for (auto &it : file_tasks) {
+        MigrateTask &task = it.second;
+        if (task.file->IsDeleted() || task.file->GetLinkFiles().empty())
+          continue;
+        task.fname = task.file->GetFilename();
+        tasks.push_back(std::move(task));
       }
     }
 
-    if (migrate_exts.size() > 0) {
+    zbd_->LogGarbageInfo();
+
+    if (tasks.size() > 0) {
       IOStatus s;
-      Info(logger_, "Garbage collecting %d extents \n",
-           (int)migrate_exts.size());
-      s = MigrateExtents(migrate_exts);
+      Info(logger_, "Garbage collecting %d extents from %d zones (%s)\n",
+           (int)nr_extents, (int)migrate_zones_start.size(),
+           gc_policy_->Name());
+      uint64_t migrated = 0;
+      s = MigrateTasks(tasks, &migrated);
       if (!s.ok()) {
         Error(logger_, "Garbage collection failed");
+      } else {
+        /* Files open for write or a lack of migrate zones can leave a
+         * cycle with nothing moved, wait for the next request then */
+        busy = migrated > 0;
       }
     }
   }
 }
 
+RaidAutoZonedBlockDevice *AquaFS::GetRaidAutoBackend() {
+  if (!zbd_->IsRAIDEnabled()) return nullptr;
+  auto be =
+      static_cast<AbstractRaidZonedBlockDevice *>(zbd_->getBackend().get());
+  if (be->getMainMode() != RaidMode::RAID_A) return nullptr;
+  return static_cast<RaidAutoZonedBlockDevice *>(be);
+}
+
+void AquaFS::RaidConvertWorker() {
+  RaidAutoZonedBlockDevice *be = GetRaidAutoBackend();
+  RaidMode cold_mode = raid_mode_from_str(FLAGS_raid_auto_cold_mode);
+  if (cold_mode != RaidMode::RAID_C) cold_mode = RaidMode::RAID0;
+  const uint64_t hot = FLAGS_raid_auto_hot_read << 20;
+  const uint64_t cold = FLAGS_raid_auto_cold_read << 20;
+
+  while (run_raid_convert_worker_) {
+    {
+      std::unique_lock<std::mutex> lock(raid_convert_mtx_);
+      raid_convert_cv_.wait_for(
+          lock, std::chrono::milliseconds(FLAGS_raid_auto_convert_interval),
+          [this] { return !run_raid_convert_worker_; });
+    }
+    if (!run_raid_convert_worker_) break;
+
+    be->ReclaimRetiredZones();
+
+    std::vector<RaidZoneHeat> heat;
+    be->GetZoneHeat(&heat);
+    std::vector<RaidZoneHeat> promote, demote;
+    for (const auto &zone : heat) {
+      /* Zones still taking writes are left until they settle */
+      if (zone.write_bytes > cold) continue;
+      if (zone.mode == RaidMode::RAID1) {
+        if (zone.read_bytes <= cold) demote.push_back(zone);
+      } else if (zone.read_bytes >= hot) {
+        promote.push_back(zone);
+      }
+    }
+    std::sort(promote.begin(), promote.end(),
+              [](const auto &a, const auto &b) {
+                return a.read_bytes > b.read_bytes;
+              });
+    std::sort(demote.begin(), demote.end(), [](const auto &a, const auto &b) {
+      return a.read_bytes < b.read_bytes;
+    });
+
+    /* Hottest zones are promoted first, promotions stop short of the free
+     * zone reserve, the capacity demotions give back refills it */
+    uint32_t budget = FLAGS_raid_auto_convert_max;
+    size_t reserve =
+        be->TotalDeviceZones() * FLAGS_raid_auto_free_reserve / 100;
+    for (const auto &zone : promote) {
+      if (budget == 0) break;
+      if (be->FreeDeviceZones() < reserve + 2 * be->nr_dev()) break;
+      if (ConvertRaidZone(be, zone.raid_zone_idx, RaidMode::RAID1).ok())
+        budget--;
+    }
+    for (const auto &zone : demote) {
+      if (budget == 0) break;
+      if (ConvertRaidZone(be, zone.raid_zone_idx, cold_mode).ok()) budget--;
+    }
+  }
+}
+
+IOStatus AquaFS::ConvertRaidZone(RaidAutoZonedBlockDevice *be,
+                                 idx_t raid_zone_idx, RaidMode mode) {
+  Zone *zone = zbd_->GetIOZone(static_cast<uint64_t>(raid_zone_idx) *
+                               zbd_->GetZoneSize());
+  /* Full zones take no more appends and the busy flag keeps them from
+   * being reset, zones without live data are not worth the copy */
+  if (zone == nullptr || !zone->IsFull() || !zone->IsUsed())
+    return IOStatus::Busy();
+  if (!zone->Acquire()) return IOStatus::Busy();
+  if (!zone->IsFull() || !zone->IsUsed()) {
+    zone->Release();
+    return IOStatus::Busy();
+  }
+
+  RaidZoneConversion conv;
+  IOStatus s = be->PrepareConversion(raid_zone_idx, mode, &conv);
+  if (s.ok()) {
+    /* Switch before logging, a meta zone roll on the way snapshots the
+     * layout instead of writing the record */
+    std::lock_guard<std::mutex> lock(files_mtx_);
+    std::string layout;
+    be->CommitConversion(conv, &layout);
+    std::string record;
+    PutFixed32(&record, kRaidInfoAppend);
+    PutLengthPrefixedSlice(&record, layout);
+    s = PersistRecord(record);
+    if (!s.ok()) {
+      Error(logger_, "Failed to log RAID-A conversion of zone %x: %s",
+            raid_zone_idx, s.ToString().c_str());
+      be->CommitConversion(conv.Reversed(), nullptr);
+    }
+  }
+  zone->Release();
+  return s;
+}
+
 IOStatus AquaFS::Repair() {
   std::map<std::string, std::shared_ptr<ZoneFile>>::iterator it;
   for (it = files_.begin(); it != files_.end(); it++) {
@@ -427,6 +607,16 @@ IOStatus AquaFS::WriteSnapshotLocked(AquaMetaLog *meta_log) {
       zoneFile->MetadataSynced();
     }
   }
+
+  /* Converted RAID-A zones are only known from the log */
+  RaidAutoZonedBlockDevice *raid_be = GetRaidAutoBackend();
+  std::string layout;
+  if (s.ok() && raid_be && raid_be->EncodeLayout(&layout)) {
+    std::string record;
+    PutFixed32(&record, kRaidInfoAppend);
+    PutLengthPrefixedSlice(&record, layout);
+    s = meta_log->AddRecord(record);
+  }
   return s;
 }
 
@@ -501,26 +691,88 @@ IOStatus AquaFS::PersistSnapshot(AquaMetaLog *meta_writer) {
   if (!s.ok()) {
     Error(logger_,
           "Failed persisting a snapshot, we should go to read only now!");
+  } else if (meta_writer == meta_log_.get()) {
+    /* Queued records were encoded before we got files_mtx_, so the
+     * snapshot already covers them */
+    CompleteRecords(s);
   }
 
   return s;
 }
 
-IOStatus AquaFS::PersistRecord(std::string record) {
-  IOStatus s;
+void AquaFS::EnqueueRecord(MetaRecord *record) {
+  std::lock_guard<std::mutex> lock(meta_queue_mtx_);
+  meta_queue_.push_back(record);
+}
 
-  std::lock_guard<std::mutex> lock(metadata_sync_mtx_);
-  s = meta_log_->AddRecord(record);
+bool AquaFS::RecordDone(MetaRecord *record) {
+  std::lock_guard<std::mutex> lock(meta_queue_mtx_);
+  return record->done;
+}
+
+void AquaFS::CompleteRecords(const IOStatus &s, size_t nr) {
+  std::lock_guard<std::mutex> lock(meta_queue_mtx_);
+  while (nr-- > 0 && !meta_queue_.empty()) {
+    MetaRecord *record = meta_queue_.front();
+    meta_queue_.pop_front();
+    record->status = s;
+    record->done = true;
+  }
+}
+
+/* Must hold metadata_sync_mtx_, and files_mtx_ if files_locked */
+IOStatus AquaFS::CommitRecordsLocked(bool files_locked) {
+  std::vector<Slice> records;
+  {
+    std::lock_guard<std::mutex> lock(meta_queue_mtx_);
+    for (auto record : meta_queue_) records.emplace_back(record->data);
+  }
+  if (records.empty()) return IOStatus::OK();
+
+  IOStatus s = meta_log_->AddRecords(records);
   if (s == IOStatus::NoSpace()) {
+    /* Leave the records queued for a committer holding files_mtx_ */
+    if (!files_locked) return s;
+
     Info(logger_, "Current meta zone full, rolling to next meta zone");
     s = RollMetaZoneLocked();
     /* After a successfull roll, a complete snapshot has been persisted
-     * - no need to write the record update */
+     * - no need to write the record updates. Nothing could be queued
+     * meanwhile as we hold files_mtx_. */
+    CompleteRecords(s);
+    return s;
   }
 
+  CompleteRecords(s, records.size());
   return s;
 }
 
+IOStatus AquaFS::WaitRecord(MetaRecord *record) {
+  {
+    std::lock_guard<std::mutex> lock(metadata_sync_mtx_);
+    if (!RecordDone(record)) CommitRecordsLocked(false);
+  }
+  if (!RecordDone(record)) {
+    /* The meta zone is full, rolling needs a consistent view of files_ */
+    std::lock_guard<std::mutex> file_lock(files_mtx_);
+    std::lock_guard<std::mutex> lock(metadata_sync_mtx_);
+    if (!RecordDone(record)) CommitRecordsLocked(true);
+  }
+  assert(RecordDone(record));
+  return record->status;
+}
+
+/* Must hold files_mtx_ */
+IOStatus AquaFS::PersistRecord(std::string record) {
+  MetaRecord meta_record;
+  meta_record.data = std::move(record);
+  EnqueueRecord(&meta_record);
+
+  std::lock_guard<std::mutex> lock(metadata_sync_mtx_);
+  if (!RecordDone(&meta_record)) CommitRecordsLocked(true);
+  return meta_record.status;
+}
+
 IOStatus AquaFS::SyncFileExtents(ZoneFile *zoneFile,
                                  std::vector<ZoneExtent *> new_extents) {
   IOStatus s;
@@ -531,6 +783,16 @@ IOStatus AquaFS::SyncFileExtents(ZoneFile *zoneFile,
   s = SyncFileMetadata(zoneFile, true);
 
   if (!s.ok()) {
+    /* The replace record is not in the log, so the file stays where the
+     * log says it is and the copies are dropped */
+    zoneFile->ReplaceExtentList(old_extents);
+    for (size_t i = 0; i < new_extents.size(); ++i) {
+      ZoneExtent *new_ext = new_extents[i];
+      if (old_extents[i]->start_ != new_ext->start_) {
+        new_ext->zone_->SubUsedCapacity(new_ext->length_);
+      }
+      delete new_ext;
+    }
     return s;
   }
 
@@ -538,7 +800,7 @@ IOStatus AquaFS::SyncFileExtents(ZoneFile *zoneFile,
   for (size_t i = 0; i < new_extents.size(); ++i) {
     ZoneExtent *old_ext = old_extents[i];
     if (old_ext->start_ != new_extents[i]->start_) {
-      old_ext->zone_->used_capacity_ -= old_ext->length_;
+      old_ext->zone_->SubUsedCapacity(old_ext->length_);
     }
     delete old_ext;
   }
@@ -547,37 +809,68 @@ IOStatus AquaFS::SyncFileExtents(ZoneFile *zoneFile,
 }
 
 /* Must hold files_mtx_ */
-IOStatus AquaFS::SyncFileMetadataNoLock(ZoneFile *zoneFile, bool replace) {
+bool AquaFS::EncodeFileMetadataNoLock(ZoneFile *zoneFile, bool replace,
+                                      std::string *output,
+                                      uint32_t *nr_extents) {
   std::string fileRecord;
-  std::string output;
-  IOStatus s;
-  AquaFSMetricsLatencyGuard guard(zbd_->GetMetrics(), AQUAFS_META_SYNC_LATENCY,
-                                  Env::Default());
 
   if (zoneFile->IsDeleted()) {
     Info(logger_, "File %s has been deleted, skip sync file metadata!",
          zoneFile->GetFilename().c_str());
-    return IOStatus::OK();
+    return false;
   }
 
   if (replace) {
-    PutFixed32(&output, kFileReplace);
+    PutFixed32(output, kFileReplace);
   } else {
     zoneFile->SetFileModificationTime(time(0));
-    PutFixed32(&output, kFileUpdate);
+    PutFixed32(output, kFileUpdate);
   }
-  zoneFile->EncodeUpdateTo(&fileRecord);
-  PutLengthPrefixedSlice(&output, Slice(fileRecord));
+  *nr_extents = zoneFile->EncodeUpdateTo(&fileRecord);
+  PutLengthPrefixedSlice(output, Slice(fileRecord));
+  return true;
+}
+
+/* Must hold files_mtx_ */
+IOStatus AquaFS::SyncFileMetadataNoLock(ZoneFile *zoneFile, bool replace) {
+  std::string output;
+  uint32_t nr_extents;
+  IOStatus s;
+  AquaFSMetricsLatencyGuard guard(zbd_->GetMetrics(), AQUAFS_META_SYNC_LATENCY,
+                                  Env::Default());
+
+  if (!EncodeFileMetadataNoLock(zoneFile, replace, &output, &nr_extents))
+    return IOStatus::OK();
 
   s = PersistRecord(output);
-  if (s.ok()) zoneFile->MetadataSynced();
+  if (s.ok()) zoneFile->MetadataSynced(nr_extents);
 
   return s;
 }
 
 IOStatus AquaFS::SyncFileMetadata(ZoneFile *zoneFile, bool replace) {
-  std::lock_guard<std::mutex> lock(files_mtx_);
-  return SyncFileMetadataNoLock(zoneFile, replace);
+  MetaRecord record;
+  uint32_t nr_extents;
+  IOStatus s;
+  AquaFSMetricsLatencyGuard guard(zbd_->GetMetrics(), AQUAFS_META_SYNC_LATENCY,
+                                  Env::Default());
+
+  /* Encode and queue in files_mtx_ order, but wait for the group commit
+   * without blocking other syncs */
+  {
+    std::lock_guard<std::mutex> lock(files_mtx_);
+    if (!EncodeFileMetadataNoLock(zoneFile, replace, &record.data,
+                                  &nr_extents))
+      return IOStatus::OK();
+    EnqueueRecord(&record);
+  }
+
+  /* Only what was encoded is synced, extents pushed by appends during the
+   * wait go into the next record */
+  s = WaitRecord(&record);
+  if (s.ok()) zoneFile->MetadataSynced(nr_extents);
+
+  return s;
 }
 
 /* Must hold files_mtx_ */
@@ -619,6 +912,16 @@ IOStatus AquaFS::DeleteFileNoLock(std::string fname, const IOOptions &options,
       zoneFile->AddLinkName(fname);
     } else {
       if (zoneFile->GetNrLinks() > 0) return s;
+      /* Learn how long files of this class live */
+      if (zoneFile->GetCreationTime() != 0) {
+        time_t now = time(0);
+        zbd_->GetLifetimePredictor()->AddSample(
+            LifetimePredictor::FileClass(fname,
+                                         zoneFile->GetWriteLifeTimeHint()),
+            now > zoneFile->GetCreationTime()
+                ? now - zoneFile->GetCreationTime()
+                : 0);
+      }
       /* Mark up the file as deleted so it won't be migrated by GC */
       zoneFile->SetDeleted();
       zoneFile.reset();
@@ -889,6 +1192,7 @@ IOStatus AquaFS::OpenWritableFile(const std::string &filename,
     zoneFile =
         std::make_shared<ZoneFile>(zbd_, next_file_id_++, &metadata_writer_);
     zoneFile->SetFileModificationTime(time(0));
+    zoneFile->SetCreationTime(time(0));
     zoneFile->AddLinkName(fname);
 
     /* RocksDB does not set the right io type(!)*/
@@ -950,6 +1254,33 @@ IOStatus AquaFS::GetFileModificationTime(const std::string &filename,
   return s;
 }
 
+IOStatus AquaFS::Poll(std::vector<void *> &io_handles,
+                      size_t min_completions) {
+  std::vector<void *> aux_handles;
+
+  for (auto h : io_handles) {
+    if (ZoneFileAsyncRead::IsAsyncRead(h))
+      static_cast<ZoneFileAsyncRead *>(h)->Complete(false);
+    else
+      aux_handles.push_back(h);
+  }
+  if (aux_handles.empty()) return IOStatus::OK();
+  return target()->Poll(aux_handles, min_completions);
+}
+
+IOStatus AquaFS::AbortIO(std::vector<void *> &io_handles) {
+  std::vector<void *> aux_handles;
+
+  for (auto h : io_handles) {
+    if (ZoneFileAsyncRead::IsAsyncRead(h))
+      static_cast<ZoneFileAsyncRead *>(h)->Complete(true);
+    else
+      aux_handles.push_back(h);
+  }
+  if (aux_handles.empty()) return IOStatus::OK();
+  return target()->AbortIO(aux_handles);
+}
+
 IOStatus AquaFS::GetFileSize(const std::string &filename,
                              const IOOptions &options, uint64_t *size,
                              IODebugContext *dbg) {
@@ -1554,6 +1885,15 @@ Status AquaFS::Mount(bool readonly) {
     return Status::IOError("Failed to mount filesystem");
   }
 
+  /* Zones were listed with the RAID-A layout Open derived from the flags,
+   * before the log replaced it */
+  RaidAutoZonedBlockDevice *raid_be = GetRaidAutoBackend();
+  if (raid_be && raid_be->layout_diverged()) {
+    if (!readonly) raid_be->ResetUnmappedZones();
+    s = zbd_->RefreshZoneStates();
+    if (!s.ok()) return s;
+  }
+
   Info(logger_, "Recovered from zone: %d", (int)valid_zones[r]->GetZoneNr());
   superblock_ = std::move(valid_superblocks[r]);
   zbd_->setFinishThreshold(superblock_->GetFinishTreshold());
@@ -1605,9 +1945,22 @@ Status AquaFS::Mount(bool readonly) {
 
     if (superblock_->IsGCEnabled()) {
       Info(logger_, "Starting garbage collection worker");
+      gc_policy_ = GCVictimPolicy::Create(FLAGS_gc_policy);
+      if (!gc_policy_) {
+        Warn(logger_, "Unknown GC policy %s, using greedy",
+             FLAGS_gc_policy.c_str());
+        gc_policy_ = std::make_unique<GreedyGCPolicy>();
+      }
       run_gc_worker_ = true;
       gc_worker_.reset(new std::thread(&AquaFS::GCWorker, this));
     }
+
+    if (FLAGS_raid_auto_convert && raid_be) {
+      Info(logger_, "Starting RAID-A conversion worker");
+      run_raid_convert_worker_ = true;
+      raid_convert_worker_.reset(
+          new std::thread(&AquaFS::RaidConvertWorker, this));
+    }
   }
 
   LogFiles();
@@ -1873,36 +2226,120 @@ void AquaFS::GetAquaFSSnapshot(AquaFSSnapshot &snapshot,
 
 IOStatus AquaFS::MigrateExtents(
     const std::vector<ZoneExtentSnapshot *> &extents) {
-  IOStatus s;
-  // Group extents by their filename
+  // Group extents by their filename, files open for write are skipped later
   std::map<std::string, std::vector<ZoneExtentSnapshot *>> file_extents;
   for (auto *ext : extents) {
-    std::string fname = ext->filename;
-    // We only migrate SST file extents
-    if (ends_with(fname, ".sst")) {
-      file_extents[fname].emplace_back(ext);
-    }
+    file_extents[ext->filename].emplace_back(ext);
   }
 
+  std::vector<MigrateTask> tasks;
   for (const auto &it : file_extents) {
-    s = MigrateFileExtents(it.first, it.second);
-    if (!s.ok()) break;
-    s = zbd_->ResetUnusedIOZones();
-    if (!s.ok()) break;
+    MigrateTask task;
+    // The file may be deleted by other threads, better double check.
+    task.file = GetFile(it.first);
+    if (task.file == nullptr) continue;
+    task.fname = it.first;
+    for (const auto *ext : it.second) task.extents[ext->start] = ext->length;
+    tasks.push_back(std::move(task));
+  }
+  return MigrateTasks(tasks);
+}
+
+IOStatus AquaFS::MigrateTasks(const std::vector<MigrateTask> &tasks,
+                              uint64_t *migrated) {
+  std::lock_guard<std::mutex> run_lock(migrate_run_mtx_);
+
+  /* Files are migrated by FLAGS_gc_threads workers, each into its own
+   * migrate zone: this thread and the persistent migrate workers */
+  MigrateBatch batch;
+  batch.tasks = &tasks;
+  if (tasks.size() > 1) {
+    {
+      std::lock_guard<std::mutex> lock(migrate_mtx_);
+      if (!run_migrate_workers_) {
+        run_migrate_workers_ = true;
+        for (unsigned int i = 1; i < FLAGS_gc_threads; i++)
+          migrate_workers_.emplace_back(&AquaFS::MigrateWorker, this);
+      }
+      migrate_batch_ = &batch;
+      migrate_gen_++;
+    }
+    migrate_cv_.notify_all();
+  }
+
+  RunMigrateBatch(batch);
+
+  {
+    std::unique_lock<std::mutex> lock(migrate_mtx_);
+    migrate_done_cv_.wait(lock, [&] { return batch.active == 0; });
+    migrate_batch_ = nullptr;
+  }
+
+  if (migrated != nullptr) *migrated += batch.moved;
+  return batch.status;
+}
+
+void AquaFS::RunMigrateBatch(MigrateBatch &batch) {
+  const auto &tasks = *batch.tasks;
+  for (size_t i; (i = batch.next++) < tasks.size();) {
+    {
+      std::lock_guard<std::mutex> lock(batch.status_mtx);
+      if (!batch.status.ok()) return;
+    }
+    uint64_t file_moved = 0;
+    IOStatus s = MigrateFileExtents(tasks[i], &file_moved);
+    batch.moved += file_moved;
+    if (s.ok()) s = zbd_->ResetUnusedIOZones();
+    if (!s.ok()) {
+      std::lock_guard<std::mutex> lock(batch.status_mtx);
+      if (batch.status.ok()) batch.status = s;
+      return;
+    }
+  }
+}
+
+void AquaFS::MigrateWorker() {
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> lock(migrate_mtx_);
+  while (true) {
+    migrate_cv_.wait(
+        lock, [&] { return !run_migrate_workers_ || migrate_gen_ != seen; });
+    if (!run_migrate_workers_) return;
+    seen = migrate_gen_;
+    // the batch may already be done by the time this worker woke up
+    auto *batch = migrate_batch_;
+    if (batch == nullptr) continue;
+    batch->active++;
+    lock.unlock();
+    RunMigrateBatch(*batch);
+    lock.lock();
+    if (--batch->active == 0) migrate_done_cv_.notify_all();
   }
-  return s;
 }
 
 IOStatus AquaFS::MigrateFileExtents(
     const std::string &fname,
     const std::vector<ZoneExtentSnapshot *> &migrate_exts) {
+  MigrateTask task;
+  // The file may be deleted by other threads, better double check.
+  task.file = GetFile(fname);
+  if (task.file == nullptr) {
+    return IOStatus::OK();
+  }
+  task.fname = fname;
+  for (const auto *ext : migrate_exts) task.extents[ext->start] = ext->length;
+  return MigrateFileExtents(task);
+}
+
+IOStatus AquaFS::MigrateFileExtents(const MigrateTask &task,
+                                    uint64_t *migrated) {
   IOStatus s = IOStatus::OK();
+  const std::string &fname = task.fname;
+  const auto &zfile = task.file;
   Info(logger_, "MigrateFileExtents, fname: %s, extent count: %lu",
-       fname.data(), migrate_exts.size());
+       fname.data(), task.extents.size());
 
-  // The file may be deleted by other threads, better double check.
-  auto zfile = GetFile(fname);
-  if (zfile == nullptr) {
+  if (zfile->IsDeleted()) {
     return IOStatus::OK();
   }
 
@@ -1922,17 +2359,15 @@ IOStatus AquaFS::MigrateFileExtents(
   // Modify the new extent list
   for (ZoneExtent *ext : new_extent_list) {
     // Check if current extent need to be migrated
-    auto it = std::find_if(migrate_exts.begin(), migrate_exts.end(),
-                           [&](const ZoneExtentSnapshot *ext_snapshot) {
-                             return ext_snapshot->start == ext->start_ &&
-                                    ext_snapshot->length == ext->length_;
-                           });
-
-    if (it == migrate_exts.end()) {
-      Info(logger_, "Migrate extent not found, ext_start: %lu", ext->start_);
+    auto it = task.extents.find(ext->start_);
+    if (it == task.extents.end() || it->second != ext->length_) {
       continue;
     }
 
+    /* Before taking the migrate zone, so other workers are not kept off it
+     * while this one sleeps */
+    gc_rate_.Throttle(ext->length_);
+
     Zone *target_zone = nullptr;
 
     // Allocate a new migration zone.
@@ -1949,21 +2384,29 @@ IOStatus AquaFS::MigrateFileExtents(
     }
 
     uint64_t target_start = target_zone->wp_;
+    IOStatus ms;
     if (zfile->IsSparse()) {
       // For buffered write, AquaFS use inlined metadata for extents and each
       // extent has a SPARSE_HEADER_SIZE.
       target_start = target_zone->wp_ + ZoneFile::SPARSE_HEADER_SIZE;
-      zfile->MigrateData(ext->start_ - ZoneFile::SPARSE_HEADER_SIZE,
-                         ext->length_ + ZoneFile::SPARSE_HEADER_SIZE,
-                         target_zone);
+      ms = zfile->MigrateData(ext->start_ - ZoneFile::SPARSE_HEADER_SIZE,
+                              ext->length_ + ZoneFile::SPARSE_HEADER_SIZE,
+                              target_zone);
       zbd_->AddGCBytesWritten(ext->length_ + ZoneFile::SPARSE_HEADER_SIZE);
     } else {
-      zfile->MigrateData(ext->start_, ext->length_, target_zone);
+      ms = zfile->MigrateData(ext->start_, ext->length_, target_zone);
       zbd_->AddGCBytesWritten(ext->length_);
     }
 
+    if (!ms.ok()) {
+      Error(logger_, "Migrate extent failed, ext_start: %lu: %s", ext->start_,
+            ms.ToString().c_str());
+      zbd_->ReleaseMigrateZone(target_zone);
+      continue;
+    }
+
     // If the file doesn't exist, skip
-    if (GetFileNoLock(fname) == nullptr) {
+    if (zfile->IsDeleted()) {
       Info(logger_, "Migrate file not exist anymore.");
       zbd_->ReleaseMigrateZone(target_zone);
       break;
@@ -1971,16 +2414,23 @@ IOStatus AquaFS::MigrateFileExtents(
 
     ext->start_ = target_start;
     ext->zone_ = target_zone;
-    ext->zone_->used_capacity_ += ext->length_;
+    ext->zone_->AddUsedCapacity(ext->length_);
+    if (migrated != nullptr) *migrated += ext->length_;
 
     zbd_->ReleaseMigrateZone(target_zone);
   }
 
-  SyncFileExtents(zfile.get(), new_extent_list);
+  /* Published with a single replace record */
+  s = SyncFileExtents(zfile.get(), new_extent_list);
   zfile->ReleaseWRLock();
+  if (!s.ok()) {
+    Error(logger_, "MigrateFileExtents failed to sync metadata, fname: %s",
+          fname.data());
+    return s;
+  }
 
   Info(logger_, "MigrateFileExtents Finished, fname: %s, extent count: %lu",
-       fname.data(), migrate_exts.size());
+       fname.data(), task.extents.size());
   return IOStatus::OK();
 }
 
@@ -10,8 +10,12 @@
 
 namespace fs = std::filesystem;
 
+#include <condition_variable>
+#include <deque>
+#include <limits>
 #include <memory>
 #include <thread>
+#include <unordered_map>
 
 
 #include "io_aquafs.h"
@@ -149,6 +153,10 @@ public:
 
   IOStatus AddRecord(const Slice &slice);
 
+  /* Appends several records with a single zone write, each record still
+   * starting on a block boundary */
+  IOStatus AddRecords(const std::vector<Slice> &slices);
+
   IOStatus ReadRecord(Slice *record, std::string *scratch);
 
   Zone *GetZone() { return zone_; };
@@ -169,10 +177,44 @@ class AquaFS : public FileSystemWrapper {
   std::mutex metadata_sync_mtx_;
   std::unique_ptr<Superblock> superblock_;
 
+  /* A metadata record waiting for a group commit */
+  struct MetaRecord {
+    std::string data;
+    IOStatus status;
+    bool done = false;
+  };
+
+  /* Records are queued in files_mtx_ order and committed by whichever
+   * waiter gets metadata_sync_mtx_ first */
+  std::mutex meta_queue_mtx_;
+  std::deque<MetaRecord *> meta_queue_;
+
   std::shared_ptr<Logger> GetLogger() { return logger_; }
 
   std::unique_ptr<std::thread> gc_worker_ = nullptr;
-  bool run_gc_worker_ = false;
+  std::atomic<bool> run_gc_worker_{false};
+  std::unique_ptr<GCVictimPolicy> gc_policy_;
+  GCRateController gc_rate_;
+
+  /* A MigrateTasks call being run, shared with the migrate workers */
+  struct MigrateBatch;
+  /* Helpers of MigrateTasks, FLAGS_gc_threads - 1 of them started on first
+   * use and kept until shutdown */
+  std::vector<std::thread> migrate_workers_;
+  bool run_migrate_workers_ = false;
+  /* Serializes MigrateTasks calls */
+  std::mutex migrate_run_mtx_;
+  /* Guards the fields below and MigrateBatch::active */
+  std::mutex migrate_mtx_;
+  std::condition_variable migrate_cv_;
+  std::condition_variable migrate_done_cv_;
+  MigrateBatch *migrate_batch_ = nullptr;
+  uint64_t migrate_gen_ = 0;
+
+  std::unique_ptr<std::thread> raid_convert_worker_ = nullptr;
+  std::atomic<bool> run_raid_convert_worker_{false};
+  std::mutex raid_convert_mtx_;
+  std::condition_variable raid_convert_cv_;
 
   struct AquaFSMetadataWriter : public MetadataWriter {
     AquaFS *aquaFS;
@@ -210,11 +252,31 @@ class AquaFS : public FileSystemWrapper {
 
   IOStatus PersistSnapshot(AquaMetaLog *meta_writer);
 
+  /* Must hold files_mtx_ */
   IOStatus PersistRecord(std::string record);
 
+  void EnqueueRecord(MetaRecord *record);
+
+  bool RecordDone(MetaRecord *record);
+
+  /* Completes the nr oldest queued records */
+  void CompleteRecords(const IOStatus &s,
+                       size_t nr = std::numeric_limits<size_t>::max());
+
+  /* Must hold metadata_sync_mtx_, rolls the meta zone only if files_locked */
+  IOStatus CommitRecordsLocked(bool files_locked);
+
+  /* Waits for a queued record without holding files_mtx_ */
+  IOStatus WaitRecord(MetaRecord *record);
+
   IOStatus SyncFileExtents(ZoneFile *zoneFile,
                            std::vector<ZoneExtent *> new_extents);
 
+  /* Must hold files_mtx_, returns false if the file has been deleted.
+   * *nr_extents is what MetadataSynced() takes once the record is durable */
+  bool EncodeFileMetadataNoLock(ZoneFile *zoneFile, bool replace,
+                                std::string *output, uint32_t *nr_extents);
+
   /* Must hold files_mtx_ */
   IOStatus SyncFileMetadataNoLock(ZoneFile *zoneFile, bool replace = false);
 
@@ -410,6 +472,11 @@ public:
                                    const IOOptions &options, uint64_t *mtime,
                                    IODebugContext *dbg) override;
 
+  IOStatus Poll(std::vector<void *> &io_handles,
+                size_t min_completions) override;
+
+  IOStatus AbortIO(std::vector<void *> &io_handles) override;
+
   // The directory structure is stored in the aux file system
 
   IOStatus IsDirectory(const std::string &path, const IOOptions &options,
@@ -520,12 +587,49 @@ public:
       const std::vector<ZoneExtentSnapshot *> &migrate_exts);
 
 private:
+  /* Extents of one file for GC to move */
+  struct MigrateTask {
+    std::shared_ptr<ZoneFile> file;
+    std::string fname;
+    /* Device start -> length */
+    std::unordered_map<uint64_t, uint64_t> extents;
+  };
+
+  /* Runs the tasks on FLAGS_gc_threads workers, adding the bytes actually
+   * moved to *migrated */
+  IOStatus MigrateTasks(const std::vector<MigrateTask> &tasks,
+                        uint64_t *migrated = nullptr);
+
+  IOStatus MigrateFileExtents(const MigrateTask &task,
+                              uint64_t *migrated = nullptr);
+
+  struct MigrateBatch {
+    const std::vector<MigrateTask> *tasks;
+    std::atomic<size_t> next{0};
+    std::atomic<uint64_t> moved{0};
+    std::mutex status_mtx;
+    IOStatus status;
+    /* Migrate workers inside RunMigrateBatch */
+    size_t active = 0;
+  };
+  /* Migrates tasks of the batch until none is left or one failed */
+  void RunMigrateBatch(MigrateBatch &batch);
+  void MigrateWorker();
+
   // moved to configuration.cc
   // const uint64_t GC_START_LEVEL =
   //     20;                      /* Enable GC when < 20% free space available */
   // const uint64_t GC_SLOPE = 3; /* GC agressiveness */
   void GCWorker();
 
+  /* The RAID-A backend, nullptr for any other backend */
+  RaidAutoZonedBlockDevice *GetRaidAutoBackend();
+  /* Moves RAID-A zones between RAID1 and striped layouts by read heat */
+  void RaidConvertWorker();
+  /* Converts one full zone and logs its new layout */
+  IOStatus ConvertRaidZone(RaidAutoZonedBlockDevice *be, idx_t raid_zone_idx,
+                           RaidMode mode);
+
  public:
   IOStatus selectZoneToOffline();
   IOStatus blockingDeviceZone(size_t device, size_t zone);
@@ -0,0 +1,90 @@
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "gc_policy_aquafs.h"
+
+#include <algorithm>
+#include <thread>
+
+#include "configuration.h"
+
+namespace aquafs {
+
+void GCVictimPolicy::Rank(std::vector<GCZoneStats> &zones) const {
+  time_t now = time(nullptr);
+  std::vector<std::pair<double, GCZoneStats>> scored;
+  scored.reserve(zones.size());
+  for (const auto &z : zones) scored.emplace_back(Score(z, now), z);
+  std::stable_sort(scored.begin(), scored.end(),
+                   [](const auto &a, const auto &b) { return a.first > b.first; });
+  for (size_t i = 0; i < zones.size(); i++) zones[i] = scored[i].second;
+}
+
+std::unique_ptr<GCVictimPolicy> GCVictimPolicy::Create(
+    const std::string &name) {
+  if (name == "greedy") return std::make_unique<GreedyGCPolicy>();
+  if (name == "cost-benefit") return std::make_unique<CostBenefitGCPolicy>();
+  if (name == "lifetime") return std::make_unique<LifetimeGCPolicy>();
+  return nullptr;
+}
+
+double GreedyGCPolicy::Score(const GCZoneStats &zone, time_t /*now*/) const {
+  return static_cast<double>(zone.garbage());
+}
+
+double CostBenefitGCPolicy::Score(const GCZoneStats &zone, time_t now) const {
+  // one extra second and byte keep fresh and empty zones comparable
+  double age = static_cast<double>(std::max<time_t>(now - zone.full_time, 0));
+  return static_cast<double>(zone.garbage()) * (age + 1) /
+         static_cast<double>(zone.used_capacity + 1);
+}
+
+double LifetimeGCPolicy::Score(const GCZoneStats &zone, time_t /*now*/) const {
+  double weight;
+  switch (zone.lifetime) {
+    case WLTH_SHORT:
+      weight = 1;
+      break;
+    case WLTH_LONG:
+      weight = 3;
+      break;
+    case WLTH_EXTREME:
+      weight = 4;
+      break;
+    default:
+      weight = 2;
+      break;
+  }
+  return weight * static_cast<double>(zone.garbage()) /
+         static_cast<double>(zone.used_capacity + 1);
+}
+
+void GCRateController::SetUrgency(double urgency) {
+  urgency = std::min(std::max(urgency, 0.0), 1.0);
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (urgency >= 1.0 || FLAGS_gc_max_rate == 0) {
+    rate_ = 0;
+  } else {
+    double min_rate = static_cast<double>(
+        std::min(FLAGS_gc_min_rate, FLAGS_gc_max_rate));
+    double max_rate = static_cast<double>(FLAGS_gc_max_rate);
+    rate_ = (min_rate + (max_rate - min_rate) * urgency) * (1 << 20);
+  }
+}
+
+void GCRateController::Throttle(uint64_t bytes) {
+  std::chrono::steady_clock::duration wait{};
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (rate_ <= 0) return;
+    auto now = std::chrono::steady_clock::now();
+    if (next_ < now) next_ = now;
+    wait = next_ - now;
+    next_ += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(bytes) / rate_));
+  }
+  if (wait.count() > 0) std::this_thread::sleep_for(wait);
+}
+
+}  // namespace aquafs
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -0,0 +1,96 @@
+#ifndef ROCKSDB_GC_POLICY_AQUAFS_H
+#define ROCKSDB_GC_POLICY_AQUAFS_H
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../base/file_system.h"
+
+namespace aquafs {
+
+/* Per-zone GC input, taken from the full zone pool of the device */
+struct GCZoneStats {
+  uint64_t start;
+  uint64_t max_capacity;
+  uint64_t used_capacity;
+  /* When the zone became full, the age of its data */
+  time_t full_time;
+  WriteLifeTimeHint lifetime;
+
+  [[nodiscard]] uint64_t garbage() const {
+    return max_capacity - used_capacity;
+  }
+};
+
+/*
+ * Victim selection policy of the GC worker: candidates with a higher score
+ * are migrated first.
+ */
+class GCVictimPolicy {
+ public:
+  virtual ~GCVictimPolicy() = default;
+
+  [[nodiscard]] virtual const char *Name() const = 0;
+  [[nodiscard]] virtual double Score(const GCZoneStats &zone,
+                                     time_t now) const = 0;
+
+  /* Sorts candidates by descending score */
+  void Rank(std::vector<GCZoneStats> &zones) const;
+
+  /* "greedy", "cost-benefit" or "lifetime", nullptr if unknown */
+  static std::unique_ptr<GCVictimPolicy> Create(const std::string &name);
+};
+
+/* Most garbage first */
+class GreedyGCPolicy : public GCVictimPolicy {
+ public:
+  [[nodiscard]] const char *Name() const override { return "greedy"; }
+  [[nodiscard]] double Score(const GCZoneStats &zone,
+                             time_t now) const override;
+};
+
+/* garbage * age / live bytes, old sparse zones first */
+class CostBenefitGCPolicy : public GCVictimPolicy {
+ public:
+  [[nodiscard]] const char *Name() const override { return "cost-benefit"; }
+  [[nodiscard]] double Score(const GCZoneStats &zone,
+                             time_t now) const override;
+};
+
+/* garbage / live bytes weighted by the lifetime hint, so live data which is
+ * about to die anyway is not moved */
+class LifetimeGCPolicy : public GCVictimPolicy {
+ public:
+  [[nodiscard]] const char *Name() const override { return "lifetime"; }
+  [[nodiscard]] double Score(const GCZoneStats &zone,
+                             time_t now) const override;
+};
+
+/*
+ * Paces GC migration writes. The rate grows linearly with the urgency of a
+ * cycle, from FLAGS_gc_min_rate to FLAGS_gc_max_rate, and is unlimited when
+ * the urgency is 1 or the rates are 0.
+ */
+class GCRateController {
+ public:
+  /* urgency in [0, 1] */
+  void SetUrgency(double urgency);
+
+  /* Blocks until bytes more may be migrated */
+  void Throttle(uint64_t bytes);
+
+ private:
+  std::mutex mtx_;
+  /* Bytes per second, 0 means unlimited */
+  double rate_ = 0;
+  std::chrono::steady_clock::time_point next_{};
+};
+
+}  // namespace aquafs
+
+#endif  // ROCKSDB_GC_POLICY_AQUAFS_H
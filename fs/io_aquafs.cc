@@ -17,8 +17,10 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -26,6 +28,7 @@
 #include "../base/env.h"
 
 #include "../base/coding.h"
+#include "configuration.h"
 
 namespace aquafs {
 
@@ -65,7 +68,10 @@ enum ZoneFileTag : uint32_t {
   kLinkedFilename = 9,
 };
 
-void ZoneFile::EncodeTo(std::string* output, uint32_t extent_start) {
+uint32_t ZoneFile::EncodeTo(std::string* output, uint32_t extent_start) {
+  /* Appends may push extents meanwhile, the record ends where it started */
+  auto nr_extents = static_cast<uint32_t>(extents_.size());
+
   PutFixed32(output, kFileID);
   PutFixed64(output, file_id_);
 
@@ -75,7 +81,7 @@ void ZoneFile::EncodeTo(std::string* output, uint32_t extent_start) {
   PutFixed32(output, kWriteLifeTimeHint);
   PutFixed32(output, (uint32_t)lifetime_);
 
-  for (uint32_t i = extent_start; i < extents_.size(); i++) {
+  for (uint32_t i = extent_start; i < nr_extents; i++) {
     std::string extent_str;
 
     PutFixed32(output, kExtent);
@@ -102,6 +108,7 @@ void ZoneFile::EncodeTo(std::string* output, uint32_t extent_start) {
     PutFixed32(output, kLinkedFilename);
     PutLengthPrefixedSlice(output, Slice(linkfiles_[i]));
   }
+  return nr_extents;
 }
 
 void ZoneFile::EncodeJson(std::ostream& json_stream) {
@@ -162,8 +169,8 @@ Status ZoneFile::DecodeFrom(Slice* input) {
         extent->zone_ = zbd_->GetIOZone(extent->start_);
         if (!extent->zone_)
           return Status::Corruption("ZoneFile", "Invalid zone extent");
-        extent->zone_->used_capacity_ += extent->length_;
-        extents_.push_back(extent);
+        extent->zone_->AddUsedCapacity(extent->length_);
+        AddExtent(extent);
         break;
       case kModificationTime:
         uint64_t ct;
@@ -214,8 +221,8 @@ Status ZoneFile::MergeUpdate(std::shared_ptr<ZoneFile> update, bool replace) {
   for (long unsigned int i = 0; i < update_extents.size(); i++) {
     ZoneExtent* extent = update_extents[i];
     Zone* zone = extent->zone_;
-    zone->used_capacity_ += extent->length_;
-    extents_.push_back(new ZoneExtent(extent->start_, extent->length_, zone));
+    zone->AddUsedCapacity(extent->length_);
+    AddExtent(new ZoneExtent(extent->start_, extent->length_, zone));
   }
   extent_start_ = update->GetExtentStart();
   is_sparse_ = update->IsSparse();
@@ -256,10 +263,12 @@ void ZoneFile::ClearExtents() {
     Zone* zone = (*e)->zone_;
 
     assert(zone && zone->used_capacity_ >= (*e)->length_);
-    zone->used_capacity_ -= (*e)->length_;
+    zone->SubUsedCapacity((*e)->length_);
+    zone->RemoveLiveExtent(*e);
     delete *e;
   }
   extents_.clear();
+  extent_ends_.clear();
 }
 
 IOStatus ZoneFile::CloseActiveZone() {
@@ -314,16 +323,23 @@ IOStatus ZoneFile::PersistMetadata() {
   return metadata_writer_->Persist(this);
 }
 
+void ZoneFile::AddExtent(ZoneExtent* extent) {
+  uint64_t end = extent_ends_.empty() ? 0 : extent_ends_.back();
+  extents_.push_back(extent);
+  extent_ends_.push_back(end + extent->length_);
+  if (extent->zone_ != nullptr) extent->zone_->AddLiveExtent(extent, this);
+}
+
 ZoneExtent* ZoneFile::GetExtent(uint64_t file_offset, uint64_t* dev_offset) {
-  for (unsigned int i = 0; i < extents_.size(); i++) {
-    if (file_offset < extents_[i]->length_) {
-      *dev_offset = extents_[i]->start_ + file_offset;
-      return extents_[i];
-    } else {
-      file_offset -= extents_[i]->length_;
-    }
-  }
-  return NULL;
+  /* First extent ending after file_offset */
+  auto it = std::upper_bound(extent_ends_.begin(), extent_ends_.end(),
+                             file_offset);
+  if (it == extent_ends_.end()) return NULL;
+
+  size_t i = it - extent_ends_.begin();
+  uint64_t extent_filepos = i == 0 ? 0 : extent_ends_[i - 1];
+  *dev_offset = extents_[i]->start_ + (file_offset - extent_filepos);
+  return extents_[i];
 }
 
 IOStatus ZoneFile::InvalidateCache(uint64_t pos, uint64_t size) {
@@ -365,7 +381,12 @@ IOStatus ZoneFile::PositionedRead(uint64_t offset, size_t n, Slice* result,
   zbd_->GetMetrics()->ReportQPS(AQUAFS_READ_QPS, 1);
 
   ReadLock lck(this);
+  return PositionedReadNoLock(offset, n, result, scratch, direct);
+}
 
+IOStatus ZoneFile::PositionedReadNoLock(uint64_t offset, size_t n,
+                                        Slice* result, char* scratch,
+                                        bool direct) {
   char* ptr;
   uint64_t r_off;
   size_t r_sz;
@@ -449,6 +470,128 @@ IOStatus ZoneFile::PositionedRead(uint64_t offset, size_t n, Slice* result,
   return s;
 }
 
+ssize_t ZoneFile::PrepareRead(uint64_t offset, size_t n, char* scratch,
+                              bool direct, std::vector<ZoneIORequest>* reqs) {
+  uint64_t r_off;
+  size_t r_sz;
+  size_t mapped = 0;
+  size_t first = reqs->size();
+  uint32_t block_sz = zbd_->GetBlockSize();
+
+  if (offset >= file_size_) return 0;
+
+  /* Limit read size to end of file */
+  if ((offset + n) > file_size_)
+    r_sz = file_size_ - offset;
+  else
+    r_sz = n;
+
+  while (mapped != r_sz) {
+    ZoneExtent* extent = GetExtent(offset + mapped, &r_off);
+    if (!extent) {
+      /* read beyond end of (synced) file data */
+      break;
+    }
+    uint64_t extent_end = extent->start_ + extent->length_;
+    size_t pread_sz = std::min(r_sz - mapped, extent_end - r_off);
+    bool last = (mapped + pread_sz == r_sz);
+
+    /* Direct reads are padded up to the block size, see PositionedRead. The
+     * padding of a piece in the middle of the range would overwrite the data
+     * of the next piece, which is read concurrently. */
+    size_t bytes_to_align = 0;
+    if (direct && pread_sz % block_sz != 0) {
+      if (!last) {
+        reqs->resize(first);
+        return -1;
+      }
+      bytes_to_align = block_sz - (pread_sz % block_sz);
+    }
+
+    ZoneIORequest req;
+    req.buf = scratch + mapped;
+    req.size = pread_sz + bytes_to_align;
+    req.pos = r_off;
+    req.direct = direct;
+    reqs->push_back(req);
+    mapped += pread_sz;
+  }
+
+  return mapped;
+}
+
+IOStatus ZoneFile::FinishRead(uint64_t offset, size_t mapped, char* scratch,
+                              bool direct, const ZoneIORequest* reqs,
+                              size_t nr_reqs, Slice* result) {
+  size_t read = 0;
+
+  for (size_t i = 0; i < nr_reqs && read < mapped; i++) {
+    size_t expected = std::min((size_t)reqs[i].size, mapped - read);
+
+    if (reqs[i].result < 0) {
+      *result = Slice(scratch, 0);
+      return IOStatus::IOError("pread error\n");
+    }
+    if ((size_t)reqs[i].result < expected) {
+      /* Short read, pick up the rest synchronously */
+      Slice rest;
+      read += reqs[i].result;
+      IOStatus s = PositionedReadNoLock(offset + read, mapped - read, &rest,
+                                        scratch + read, direct);
+      if (!s.ok()) {
+        *result = Slice(scratch, 0);
+        return s;
+      }
+      read += rest.size();
+      break;
+    }
+    read += expected;
+  }
+
+  *result = Slice(scratch, read);
+  return IOStatus::OK();
+}
+
+IOStatus ZoneFile::MultiRead(FSReadRequest* reqs, size_t num_reqs,
+                             bool direct) {
+  AquaFSMetricsLatencyGuard guard(zbd_->GetMetrics(), AQUAFS_READ_LATENCY,
+                                  Env::Default());
+  zbd_->GetMetrics()->ReportQPS(AQUAFS_READ_QPS, num_reqs);
+
+  ReadLock lck(this);
+
+  std::vector<ZoneIORequest> io_reqs;
+  std::vector<ssize_t> mapped(num_reqs);
+  std::vector<size_t> first(num_reqs + 1);
+
+  for (size_t i = 0; i < num_reqs; i++) {
+    first[i] = io_reqs.size();
+    mapped[i] = PrepareRead(reqs[i].offset, reqs[i].len, reqs[i].scratch,
+                            direct, &io_reqs);
+  }
+  first[num_reqs] = io_reqs.size();
+
+  if (!io_reqs.empty()) {
+    std::unique_ptr<ZoneIOBatch> batch =
+        zbd_->SubmitIO(io_reqs.data(), io_reqs.size());
+    batch->Poll(true);
+  }
+
+  for (size_t i = 0; i < num_reqs; i++) {
+    FSReadRequest& req = reqs[i];
+    if (mapped[i] < 0) {
+      req.status = PositionedReadNoLock(req.offset, req.len, &req.result,
+                                        req.scratch, direct);
+    } else {
+      req.status = FinishRead(req.offset, mapped[i], req.scratch, direct,
+                              io_reqs.data() + first[i],
+                              first[i + 1] - first[i], &req.result);
+    }
+  }
+
+  return IOStatus::OK();
+}
+
 void ZoneFile::PushExtent() {
   uint64_t length;
 
@@ -460,16 +603,21 @@ void ZoneFile::PushExtent() {
   if (length == 0) return;
 
   assert(length <= (active_zone_->wp_ - extent_start_));
-  extents_.push_back(new ZoneExtent(extent_start_, length, active_zone_));
+  AddExtent(new ZoneExtent(extent_start_, length, active_zone_));
 
-  active_zone_->used_capacity_ += length;
+  active_zone_->AddUsedCapacity(length);
   extent_start_ = active_zone_->wp_;
   extent_filepos_ = file_size_;
 }
 
 IOStatus ZoneFile::AllocateNewZone() {
   Zone* zone;
-  IOStatus s = zbd_->AllocateIOZone(lifetime_, io_type_, &zone);
+  time_t predicted_death = 0;
+  if (!linkfiles_.empty())
+    predicted_death = zbd_->GetLifetimePredictor()->PredictDeath(
+        GetFilename(), lifetime_, create_time_);
+  IOStatus s =
+      zbd_->AllocateIOZone(lifetime_, io_type_, &zone, predicted_death);
 
   if (!s.ok()) return s;
   if (!zone) {
@@ -514,11 +662,10 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
     s = active_zone_->Append(buffer, wr_size + pad_sz);
     if (!s.ok()) return s;
 
-    extents_.push_back(
-        new ZoneExtent(extent_start_, extent_length, active_zone_));
+    AddExtent(new ZoneExtent(extent_start_, extent_length, active_zone_));
 
     extent_start_ = active_zone_->wp_;
-    active_zone_->used_capacity_ += extent_length;
+    active_zone_->AddUsedCapacity(extent_length);
     file_size_ += extent_length;
     left -= extent_length;
 
@@ -571,12 +718,11 @@ IOStatus ZoneFile::SparseAppend(char* sparse_buffer, uint32_t data_size) {
     s = active_zone_->Append(sparse_buffer, wr_size + pad_sz);
     if (!s.ok()) return s;
 
-    extents_.push_back(
-        new ZoneExtent(extent_start_ + ZoneFile::SPARSE_HEADER_SIZE,
-                       extent_length, active_zone_));
+    AddExtent(new ZoneExtent(extent_start_ + ZoneFile::SPARSE_HEADER_SIZE,
+                             extent_length, active_zone_));
 
     extent_start_ = active_zone_->wp_;
-    active_zone_->used_capacity_ += extent_length;
+    active_zone_->AddUsedCapacity(extent_length);
     file_size_ += extent_length;
     left -= extent_length;
 
@@ -641,14 +787,14 @@ IOStatus ZoneFile::RecoverSparseExtents(uint64_t start, uint64_t end,
   IOStatus s;
   uint32_t block_sz = GetBlockSize();
   uint64_t next_extent_start = start;
-  char* buffer;
   int recovered_segments = 0;
   int ret;
 
-  ret = posix_memalign((void**)&buffer, sysconf(_SC_PAGESIZE), block_sz);
-  if (ret) {
+  IOBuffer buf = zbd_->GetBufferPool()->Allocate(block_sz);
+  if (!buf) {
     return IOStatus::IOError("Out of memory while recovering");
   }
+  char* buffer = buf.data();
 
   while (next_extent_start < end) {
     uint64_t extent_length;
@@ -666,9 +812,9 @@ IOStatus ZoneFile::RecoverSparseExtents(uint64_t start, uint64_t end,
     }
     recovered_segments++;
 
-    zone->used_capacity_ += extent_length;
-    extents_.push_back(new ZoneExtent(next_extent_start + SPARSE_HEADER_SIZE,
-                                      extent_length, zone));
+    zone->AddUsedCapacity(extent_length);
+    AddExtent(new ZoneExtent(next_extent_start + SPARSE_HEADER_SIZE,
+                             extent_length, zone));
 
     uint64_t extent_blocks = (extent_length + SPARSE_HEADER_SIZE) / block_sz;
     if ((extent_length + SPARSE_HEADER_SIZE) % block_sz) {
@@ -677,7 +823,6 @@ IOStatus ZoneFile::RecoverSparseExtents(uint64_t start, uint64_t end,
     next_extent_start += extent_blocks * block_sz;
   }
 
-  free(buffer);
   return s;
 }
 
@@ -715,8 +860,8 @@ IOStatus ZoneFile::Recover() {
   } else {
     /* For non-sparse files, the data is contigous and we can recover directly
        any missing data using the WP */
-    zone->used_capacity_ += to_recover;
-    extents_.push_back(new ZoneExtent(extent_start_, to_recover, zone));
+    zone->AddUsedCapacity(to_recover);
+    AddExtent(new ZoneExtent(extent_start_, to_recover, zone));
   }
 
   /* Mark up the file as having no missing extents */
@@ -736,7 +881,11 @@ void ZoneFile::ReplaceExtentList(std::vector<ZoneExtent*> new_list) {
   assert(new_list.size() == extents_.size());
 
   WriteLock lck(this);
-  extents_ = new_list;
+  /* The old extents are freed by the caller */
+  for (auto extent : extents_) extent->zone_->RemoveLiveExtent(extent);
+  extents_.clear();
+  extent_ends_.clear();
+  for (auto extent : new_list) AddExtent(extent);
 }
 
 void ZoneFile::AddLinkName(const std::string& linkf) {
@@ -1038,12 +1187,126 @@ void ZonedWritableFile::SetWriteLifeTimeHint(WriteLifeTimeHint hint) {
   zoneFile_->SetWriteLifeTimeHint(hint);
 }
 
+void ZoneFileReadahead::SetEnabled(bool enabled) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  enabled_ = enabled;
+  seq_reads_ = 0;
+  window_ = 0;
+  if (!enabled_) Release();
+}
+
+void ZoneFileReadahead::Release() {
+  free(buf_);
+  buf_ = nullptr;
+  buf_cap_ = 0;
+  buf_len_ = 0;
+}
+
+IOStatus ZoneFileReadahead::Fill(uint64_t offset, size_t n) {
+  if (buf_cap_ < n) {
+    char* buf;
+    if (posix_memalign((void**)&buf, zfile_->GetBlockSize(), n))
+      return IOStatus::IOError("failed allocating readahead buffer\n");
+    free(buf_);
+    buf_ = buf;
+    buf_cap_ = n;
+  }
+
+  FSReadRequest req;
+  req.offset = offset;
+  req.len = n;
+  req.scratch = buf_;
+  IOStatus s = zfile_->MultiRead(&req, 1, false);
+  if (s.ok()) s = req.status;
+  if (!s.ok()) {
+    buf_len_ = 0;
+    return s;
+  }
+
+  buf_off_ = offset;
+  buf_len_ = req.result.size();
+  return IOStatus::OK();
+}
+
+IOStatus ZoneFileReadahead::Read(uint64_t offset, size_t n, Slice* result,
+                                 char* scratch) {
+  /* Concurrent readers of one file are not sequential, keep them off the
+   * readahead path instead of serializing them */
+  std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+  if (!lock.owns_lock())
+    return zfile_->PositionedRead(offset, n, result, scratch, false);
+
+  size_t copied = 0;
+
+  if (offset >= buf_off_ && offset < buf_off_ + buf_len_) {
+    copied = std::min(n, (size_t)(buf_off_ + buf_len_ - offset));
+    memcpy(scratch, buf_ + (offset - buf_off_), copied);
+  }
+
+  if (enabled_ && offset == next_off_) {
+    seq_reads_++;
+  } else {
+    seq_reads_ = 0;
+    window_ = 0;
+    /* A random read the window did not serve, do not keep up to
+     * FLAGS_readahead_max around until the file is closed */
+    if (copied == 0) Release();
+  }
+  next_off_ = offset + n;
+
+  if (copied == n) {
+    *result = Slice(scratch, n);
+    return IOStatus::OK();
+  }
+
+  uint64_t rest_off = offset + copied;
+  size_t rest = n - copied;
+  Slice rest_result;
+  IOStatus s;
+
+  if (seq_reads_ < 2 || rest > FLAGS_readahead_max) {
+    lock.unlock();
+    s = zfile_->PositionedRead(rest_off, rest, &rest_result, scratch + copied,
+                               false);
+    if (!s.ok()) return s;
+    *result = Slice(scratch, copied + rest_result.size());
+    return IOStatus::OK();
+  }
+
+  if (window_ == 0)
+    window_ = FLAGS_readahead_min;
+  else
+    window_ = std::min(window_ * 2, (size_t)FLAGS_readahead_max);
+
+  s = Fill(rest_off, std::max(window_, rest));
+  if (!s.ok()) return s;
+
+  rest = std::min(rest, buf_len_);
+  memcpy(scratch + copied, buf_, rest);
+  *result = Slice(scratch, copied + rest);
+  return IOStatus::OK();
+}
+
+IOStatus ZoneFileReadahead::Prefetch(uint64_t offset, size_t n) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (!enabled_) return IOStatus::OK();
+
+  if (offset >= buf_off_ && offset + n <= buf_off_ + buf_len_)
+    return IOStatus::OK();
+
+  next_off_ = offset;
+  return Fill(offset, std::min(n, (size_t)FLAGS_readahead_max));
+}
+
 IOStatus ZonedSequentialFile::Read(size_t n, const IOOptions& /*options*/,
                                    Slice* result, char* scratch,
                                    IODebugContext* /*dbg*/) {
   IOStatus s;
 
-  s = zoneFile_->PositionedRead(rp, n, result, scratch, direct_);
+  if (!direct_ && FLAGS_readahead_max > 0)
+    s = readahead_.Read(rp, n, result, scratch);
+  else
+    s = zoneFile_->PositionedRead(rp, n, result, scratch, direct_);
   if (s.ok()) rp += result->size();
 
   return s;
@@ -1067,9 +1330,102 @@ IOStatus ZonedRandomAccessFile::Read(uint64_t offset, size_t n,
                                      const IOOptions& /*options*/,
                                      Slice* result, char* scratch,
                                      IODebugContext* /*dbg*/) const {
+  if (!direct_ && FLAGS_readahead_max > 0)
+    return readahead_->Read(offset, n, result, scratch);
   return zoneFile_->PositionedRead(offset, n, result, scratch, direct_);
 }
 
+IOStatus ZonedRandomAccessFile::Prefetch(uint64_t offset, size_t n,
+                                         const IOOptions& /*options*/,
+                                         IODebugContext* /*dbg*/) {
+  /* Direct readers keep their own prefetch buffers */
+  if (direct_ || FLAGS_readahead_max == 0) return IOStatus::OK();
+  return readahead_->Prefetch(offset, n);
+}
+
+IOStatus ZonedRandomAccessFile::MultiRead(FSReadRequest* reqs,
+                                          size_t num_reqs,
+                                          const IOOptions& /*options*/,
+                                          IODebugContext* /*dbg*/) {
+  return zoneFile_->MultiRead(reqs, num_reqs, direct_);
+}
+
+namespace {
+
+/* Async reads currently in flight, so AquaFS::Poll can tell its handles
+ * apart from the ones of the aux file system */
+std::mutex async_reads_mtx;
+std::unordered_set<void*> async_reads;
+
+}  // namespace
+
+ZoneFileAsyncRead::ZoneFileAsyncRead(
+    std::shared_ptr<ZoneFile> zfile, bool direct, const FSReadRequest& req,
+    std::function<void(const FSReadRequest&, void*)> cb, void* cb_arg)
+    : zfile_(std::move(zfile)),
+      direct_(direct),
+      req_(req),
+      cb_(std::move(cb)),
+      cb_arg_(cb_arg),
+      lock_(new ZoneFile::ReadLock(zfile_.get())) {}
+
+ZoneFileAsyncRead::~ZoneFileAsyncRead() {
+  std::lock_guard<std::mutex> lock(async_reads_mtx);
+  async_reads.erase(this);
+}
+
+bool ZoneFileAsyncRead::Submit() {
+  mapped_ = zfile_->PrepareRead(req_.offset, req_.len, req_.scratch, direct_,
+                                &io_reqs_);
+  if (mapped_ <= 0 || io_reqs_.empty()) return false;
+
+  batch_ = zfile_->GetZbd()->SubmitIO(io_reqs_.data(), io_reqs_.size());
+  std::lock_guard<std::mutex> lock(async_reads_mtx);
+  async_reads.insert(this);
+  return true;
+}
+
+void ZoneFileAsyncRead::Complete(bool abort) {
+  if (done_) return;
+  /* Requests can not be cancelled once submitted, wait for them to land */
+  batch_->Poll(true);
+  done_ = true;
+  if (abort) {
+    lock_.reset();
+    return;
+  }
+  req_.status = zfile_->FinishRead(req_.offset, mapped_, req_.scratch,
+                                   direct_, io_reqs_.data(), io_reqs_.size(),
+                                   &req_.result);
+  lock_.reset();
+  cb_(req_, cb_arg_);
+}
+
+bool ZoneFileAsyncRead::IsAsyncRead(void* io_handle) {
+  std::lock_guard<std::mutex> lock(async_reads_mtx);
+  return async_reads.find(io_handle) != async_reads.end();
+}
+
+IOStatus ZonedRandomAccessFile::ReadAsync(
+    FSReadRequest& req, const IOOptions& opts,
+    std::function<void(const FSReadRequest&, void*)> cb, void* cb_arg,
+    void** io_handle, IOHandleDeleter* del_fn, IODebugContext* dbg) {
+  auto read = new ZoneFileAsyncRead(zoneFile_, direct_, req, cb, cb_arg);
+
+  if (!read->Submit()) {
+    /* Nothing to overlap, complete the read in place */
+    delete read;
+    req.status = Read(req.offset, req.len, opts, &req.result, req.scratch, dbg);
+    cb(req, cb_arg);
+    return IOStatus::OK();
+  }
+
+  zoneFile_->GetZBDMetrics()->ReportQPS(AQUAFS_READ_QPS, 1);
+  *io_handle = read;
+  *del_fn = [](void* h) { delete static_cast<ZoneFileAsyncRead*>(h); };
+  return IOStatus::OK();
+}
+
 IOStatus ZoneFile::MigrateData(uint64_t offset, uint32_t length,
                                Zone* target_zone) {
   uint32_t step = 128 << 10;
@@ -1081,28 +1437,56 @@ IOStatus ZoneFile::MigrateData(uint64_t offset, uint32_t length,
     return IOStatus::IOError("MigrateData offset is not aligned!\n");
   }
 
-  char* buf;
-  int ret = posix_memalign((void**)&buf, block_sz, step);
-  if (ret) {
+  if (length == 0) return IOStatus::OK();
+
+  /* Double buffered: the next chunk is read while the current one is
+   * appended to the target zone */
+  IOBuffer buffers[2] = {zbd_->GetBufferPool()->Allocate(step),
+                         zbd_->GetBufferPool()->Allocate(step)};
+  if (!buffers[0] || !buffers[1]) {
     return IOStatus::IOError("failed allocating alignment write buffer\n");
   }
 
-  int pad_sz = 0;
-  while (length > 0) {
-    read_sz = length > read_sz ? read_sz : length;
-    pad_sz = read_sz % block_sz == 0 ? 0 : (block_sz - (read_sz % block_sz));
+  struct Chunk {
+    ZoneIORequest req;
+    uint32_t data_sz;
+    std::unique_ptr<ZoneIOBatch> batch;
+  } chunks[2];
+
+  auto start_read = [&](Chunk& c, char* buf) {
+    read_sz = length > step ? step : length;
+    int pad_sz =
+        read_sz % block_sz == 0 ? 0 : (block_sz - (read_sz % block_sz));
+    c.req = ZoneIORequest{buf, read_sz + pad_sz, offset, false, true};
+    c.data_sz = read_sz;
+    c.batch = zbd_->SubmitIO(&c.req, 1);
+    length -= read_sz;
+    offset += read_sz + pad_sz;
+  };
 
-    int r = zbd_->Read(buf, offset, read_sz + pad_sz, true);
+  int cur = 0;
+  start_read(chunks[cur], buffers[cur].data());
+  while (true) {
+    Chunk& c = chunks[cur];
+    c.batch->Poll(true);
+    int r = c.req.result;
     if (r < 0) {
-      free(buf);
-      return IOStatus::IOError(strerror(errno));
+      return IOStatus::IOError(strerror(-r));
     }
-    target_zone->Append(buf, r);
-    length -= read_sz;
-    offset += r;
-  }
+    if (static_cast<uint32_t>(r) < c.data_sz) {
+      return IOStatus::IOError("Short read while migrating data");
+    }
+
+    bool more = length > 0;
+    if (more) start_read(chunks[cur ^ 1], buffers[cur ^ 1].data());
 
-  free(buf);
+    /* The target zone takes whole blocks, append the padded length rather
+     * than what the read returned */
+    IOStatus s = target_zone->Append(c.req.buf, c.req.size);
+    if (!s.ok()) return s;
+    if (!more) break;
+    cur ^= 1;
+  }
 
   return IOStatus::OK();
 }
@@ -13,6 +13,9 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
@@ -48,13 +51,15 @@ class MetadataWriter {
   virtual IOStatus Persist(ZoneFile* zoneFile) = 0;
 };
 
-class ZoneFile {
+class ZoneFile : public std::enable_shared_from_this<ZoneFile> {
  private:
   const uint64_t NO_EXTENT = 0xffffffffffffffff;
 
   ZonedBlockDevice* zbd_;
 
   std::vector<ZoneExtent*> extents_;
+  /* File offset of the end of each extent, for binary search in GetExtent */
+  std::vector<uint64_t> extent_ends_;
   std::vector<std::string> linkfiles_;
 
   Zone* active_zone_;
@@ -73,11 +78,16 @@ class ZoneFile {
   time_t m_time_;
   bool is_sparse_ = false;
   bool is_deleted_ = false;
+  time_t create_time_ = 0;
 
   MetadataWriter* metadata_writer_ = NULL;
 
   std::mutex writer_mtx_;
   std::atomic<int> readers_{0};
+  /* Signalled when the last reader leaves. An async read holds its
+   * ReadLock until it is polled, so writers sleep on this rather than spin */
+  std::mutex readers_mtx_;
+  std::condition_variable readers_cv_;
 
  public:
   static const int SPARSE_HEADER_SIZE = 8;
@@ -100,6 +110,9 @@ class ZoneFile {
   IOStatus BufferedAppend(char* data, uint32_t size);
   IOStatus SparseAppend(char* data, uint32_t size);
   IOStatus SetWriteLifeTimeHint(WriteLifeTimeHint lifetime);
+  /* Only files created in this mount know when they were created */
+  void SetCreationTime(time_t t) { create_time_ = t; }
+  time_t GetCreationTime() const { return create_time_; }
   void SetIOType(IOType io_type);
   std::string GetFilename();
   time_t GetFileModificationTime();
@@ -115,17 +128,33 @@ class ZoneFile {
 
   IOStatus PositionedRead(uint64_t offset, size_t n, Slice* result,
                           char* scratch, bool direct);
+  IOStatus MultiRead(FSReadRequest* reqs, size_t num_reqs, bool direct);
+
+  /* Batched reads: PrepareRead maps a file range onto device requests
+   * (appended to reqs) and returns the number of bytes they cover, or -1 if
+   * the range must be read with PositionedRead instead. FinishRead builds the
+   * result once those requests completed. Both must hold a ReadLock. */
+  ssize_t PrepareRead(uint64_t offset, size_t n, char* scratch, bool direct,
+                      std::vector<ZoneIORequest>* reqs);
+  IOStatus FinishRead(uint64_t offset, size_t mapped, char* scratch,
+                      bool direct, const ZoneIORequest* reqs, size_t nr_reqs,
+                      Slice* result);
   ZoneExtent* GetExtent(uint64_t file_offset, uint64_t* dev_offset);
   void PushExtent();
   IOStatus AllocateNewZone();
 
-  void EncodeTo(std::string* output, uint32_t extent_start);
-  void EncodeUpdateTo(std::string* output) {
-    EncodeTo(output, nr_synced_extents_);
+  /* Returns the number of extents the record covers */
+  uint32_t EncodeTo(std::string* output, uint32_t extent_start);
+  uint32_t EncodeUpdateTo(std::string* output) {
+    return EncodeTo(output, nr_synced_extents_);
   };
   void EncodeSnapshotTo(std::string* output) { EncodeTo(output, 0); };
   void EncodeJson(std::ostream& json_stream);
   void MetadataSynced() { nr_synced_extents_ = extents_.size(); };
+  /* Extents pushed after the record was encoded stay unsynced */
+  void MetadataSynced(uint32_t nr_extents) {
+    nr_synced_extents_ = nr_extents;
+  };
   void MetadataUnsynced() { nr_synced_extents_ = 0; };
 
   IOStatus MigrateData(uint64_t offset, uint32_t length, Zone* target_zone);
@@ -153,6 +182,10 @@ class ZoneFile {
   IOStatus InvalidateCache(uint64_t pos, uint64_t size);
 
  private:
+  void AddExtent(ZoneExtent* extent);
+  /* Must hold a ReadLock */
+  IOStatus PositionedReadNoLock(uint64_t offset, size_t n, Slice* result,
+                                char* scratch, bool direct);
   void ReleaseActiveZone();
   void SetActiveZone(Zone* zone);
   IOStatus CloseActiveZone();
@@ -172,7 +205,12 @@ class ZoneFile {
       zfile_->readers_++;
       zfile_->writer_mtx_.unlock();
     }
-    ~ReadLock() { zfile_->readers_--; }
+    ~ReadLock() {
+      if (--zfile_->readers_ == 0) {
+        std::lock_guard<std::mutex> lock(zfile_->readers_mtx_);
+        zfile_->readers_cv_.notify_all();
+      }
+    }
 
    private:
     ZoneFile* zfile_;
@@ -180,9 +218,10 @@ class ZoneFile {
   class WriteLock {
    public:
     WriteLock(ZoneFile* zfile) : zfile_(zfile) {
+      /* New readers stay out until the destructor unlocks */
       zfile_->writer_mtx_.lock();
-      while (zfile_->readers_ > 0) {
-      }
+      std::unique_lock<std::mutex> lock(zfile_->readers_mtx_);
+      zfile_->readers_cv_.wait(lock, [this] { return zfile_->readers_ == 0; });
     }
     ~WriteLock() { zfile_->writer_mtx_.unlock(); }
 
@@ -258,18 +297,51 @@ class ZonedWritableFile : public FSWritableFile {
   std::mutex buffer_mtx_;
 };
 
+/* Readahead of one open file for buffered reads. Once two reads in a row
+ * are sequential, reads are served from a window that doubles on every
+ * refill, from FLAGS_readahead_min up to FLAGS_readahead_max. The window is
+ * freed once the reads turn random. */
+class ZoneFileReadahead {
+ public:
+  explicit ZoneFileReadahead(ZoneFile* zfile) : zfile_(zfile) {}
+  ~ZoneFileReadahead() { free(buf_); }
+
+  IOStatus Read(uint64_t offset, size_t n, Slice* result, char* scratch);
+  IOStatus Prefetch(uint64_t offset, size_t n);
+  void SetEnabled(bool enabled);
+
+ private:
+  ZoneFile* zfile_;
+  std::mutex mtx_;
+  bool enabled_ = true;
+  char* buf_ = nullptr;
+  size_t buf_cap_ = 0;
+  uint64_t buf_off_ = 0;
+  size_t buf_len_ = 0;
+  uint64_t next_off_ = 0;
+  uint32_t seq_reads_ = 0;
+  size_t window_ = 0;
+
+  /* Must hold mtx_ */
+  IOStatus Fill(uint64_t offset, size_t n);
+  /* Must hold mtx_; frees the window */
+  void Release();
+};
+
 class ZonedSequentialFile : public FSSequentialFile {
  private:
   std::shared_ptr<ZoneFile> zoneFile_;
   uint64_t rp;
   bool direct_;
+  ZoneFileReadahead readahead_;
 
  public:
   explicit ZonedSequentialFile(std::shared_ptr<ZoneFile> zoneFile,
                                const FileOptions& file_opts)
       : zoneFile_(zoneFile),
         rp(0),
-        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()) {}
+        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()),
+        readahead_(zoneFile.get()) {}
 
   IOStatus Read(size_t n, const IOOptions& options, Slice* result,
                 char* scratch, IODebugContext* dbg) override;
@@ -289,27 +361,71 @@ class ZonedSequentialFile : public FSSequentialFile {
   }
 };
 
+/* A ZonedRandomAccessFile::ReadAsync request in flight, completed by
+ * AquaFS::Poll or AquaFS::AbortIO */
+class ZoneFileAsyncRead {
+ public:
+  ZoneFileAsyncRead(std::shared_ptr<ZoneFile> zfile, bool direct,
+                    const FSReadRequest& req,
+                    std::function<void(const FSReadRequest&, void*)> cb,
+                    void* cb_arg);
+  ~ZoneFileAsyncRead();
+
+  /* Returns false if there is nothing to submit asynchronously */
+  bool Submit();
+  /* Waits for the read and runs the callback, unless aborted */
+  void Complete(bool abort);
+
+  static bool IsAsyncRead(void* io_handle);
+
+ private:
+  std::shared_ptr<ZoneFile> zfile_;
+  bool direct_;
+  FSReadRequest req_;
+  std::function<void(const FSReadRequest&, void*)> cb_;
+  void* cb_arg_;
+  bool done_ = false;
+  ssize_t mapped_ = 0;
+  /* Destroyed in reverse order: the batch is drained before the requests it
+   * points to and the extents they were mapped from are released */
+  std::unique_ptr<ZoneFile::ReadLock> lock_;
+  std::vector<ZoneIORequest> io_reqs_;
+  std::unique_ptr<ZoneIOBatch> batch_;
+};
+
 class ZonedRandomAccessFile : public FSRandomAccessFile {
  private:
   std::shared_ptr<ZoneFile> zoneFile_;
   bool direct_;
+  /* Read is const, the readahead state is not */
+  std::unique_ptr<ZoneFileReadahead> readahead_;
 
  public:
   explicit ZonedRandomAccessFile(std::shared_ptr<ZoneFile> zoneFile,
                                  const FileOptions& file_opts)
       : zoneFile_(zoneFile),
-        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()) {}
+        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()),
+        readahead_(new ZoneFileReadahead(zoneFile.get())) {}
 
   IOStatus Read(uint64_t offset, size_t n, const IOOptions& options,
                 Slice* result, char* scratch,
                 IODebugContext* dbg) const override;
 
-  IOStatus Prefetch(uint64_t /*offset*/, size_t /*n*/,
-                    const IOOptions& /*options*/,
-                    IODebugContext* /*dbg*/) override {
-    return IOStatus::OK();
+  IOStatus Prefetch(uint64_t offset, size_t n, const IOOptions& options,
+                    IODebugContext* dbg) override;
+
+  void Hint(AccessPattern pattern) override {
+    readahead_->SetEnabled(pattern != kRandom);
   }
 
+  IOStatus MultiRead(FSReadRequest* reqs, size_t num_reqs,
+                     const IOOptions& options, IODebugContext* dbg) override;
+
+  IOStatus ReadAsync(FSReadRequest& req, const IOOptions& opts,
+                     std::function<void(const FSReadRequest&, void*)> cb,
+                     void* cb_arg, void** io_handle, IOHandleDeleter* del_fn,
+                     IODebugContext* dbg) override;
+
   bool use_direct_io() const override { return direct_; }
 
   size_t GetRequiredBufferAlignment() const override {
@@ -0,0 +1,66 @@
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "lifetime_aquafs.h"
+
+#include <algorithm>
+
+#include "configuration.h"
+
+namespace aquafs {
+
+static bool has_suffix(const std::string &value, const std::string &suffix) {
+  return value.size() >= suffix.size() &&
+         value.compare(value.size() - suffix.size(), suffix.size(), suffix) ==
+             0;
+}
+
+int LifetimePredictor::FileClass(const std::string &fname,
+                                 WriteLifeTimeHint hint) {
+  FileKind kind = kOther;
+  auto base = fname.substr(fname.find_last_of('/') + 1);
+  if (has_suffix(base, ".sst"))
+    kind = kSST;
+  else if (has_suffix(base, ".log"))
+    kind = kWAL;
+  else if (base.rfind("MANIFEST", 0) == 0)
+    kind = kManifest;
+  else if (has_suffix(base, ".blob"))
+    kind = kBlob;
+  int h = hint < WLTH_NOT_SET || hint > WLTH_EXTREME ? WLTH_NOT_SET : hint;
+  return kind * (WLTH_EXTREME + 1) + h;
+}
+
+void LifetimePredictor::AddSample(int file_class, uint64_t lifetime) {
+  if (file_class < 0 || file_class >= kNrClasses) return;
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto &stats = stats_[file_class];
+  /* Plain average until the moving average has enough history */
+  double alpha = std::max(kAlpha, 1.0 / static_cast<double>(
+                                              stats.nr_samples + 1));
+  stats.avg_lifetime += alpha * (static_cast<double>(lifetime) -
+                                 stats.avg_lifetime);
+  stats.nr_samples++;
+}
+
+uint64_t LifetimePredictor::Predict(int file_class) {
+  if (file_class < 0 || file_class >= kNrClasses) return 0;
+  std::lock_guard<std::mutex> lock(mtx_);
+  const auto &stats = stats_[file_class];
+  if (stats.nr_samples < kMinSamples) return 0;
+  /* Round up so a known class never predicts "unknown" */
+  return static_cast<uint64_t>(stats.avg_lifetime) + 1;
+}
+
+time_t LifetimePredictor::PredictDeath(const std::string &fname,
+                                       WriteLifeTimeHint hint,
+                                       time_t create_time) {
+  if (!FLAGS_lifetime_learning) return 0;
+  uint64_t lifetime = Predict(FileClass(fname, hint));
+  if (lifetime == 0) return 0;
+  if (create_time == 0) create_time = time(nullptr);
+  return create_time + static_cast<time_t>(lifetime);
+}
+
+}  // namespace aquafs
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
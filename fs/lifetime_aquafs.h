@@ -0,0 +1,55 @@
+#ifndef ROCKSDB_LIFETIME_AQUAFS_H
+#define ROCKSDB_LIFETIME_AQUAFS_H
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+
+#include "../base/file_system.h"
+
+namespace aquafs {
+
+/*
+ * Learns how long files live, from creation to deletion, per file class
+ * (kind of file by name and the write lifetime hint RocksDB gave it), and
+ * predicts when a new file of a class will be deleted. Zones are filled
+ * with files of about the same predicted death, so they turn into garbage
+ * all at once.
+ */
+class LifetimePredictor {
+ public:
+  enum FileKind { kSST = 0, kWAL, kManifest, kBlob, kOther, kNrKinds };
+
+  static constexpr int kNrClasses = kNrKinds * (WLTH_EXTREME + 1);
+  /* Samples of a class before its predictions are used */
+  static constexpr uint64_t kMinSamples = 8;
+  /* Weight of a new sample in the moving average */
+  static constexpr double kAlpha = 0.125;
+
+  static int FileClass(const std::string &fname, WriteLifeTimeHint hint);
+
+  void AddSample(int file_class, uint64_t lifetime);
+
+  /* Expected lifetime in seconds, 0 if unknown */
+  uint64_t Predict(int file_class);
+
+  /* Expected deletion time of a file created at create_time, or now if
+   * create_time is 0; 0 if unknown */
+  time_t PredictDeath(const std::string &fname, WriteLifeTimeHint hint,
+                      time_t create_time);
+
+ private:
+  struct ClassStats {
+    uint64_t nr_samples = 0;
+    double avg_lifetime = 0;
+  };
+
+  std::mutex mtx_;
+  std::array<ClassStats, kNrClasses> stats_{};
+};
+
+}  // namespace aquafs
+
+#endif  // ROCKSDB_LIFETIME_AQUAFS_H
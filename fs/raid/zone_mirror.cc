@@ -0,0 +1,67 @@
+#include "zone_mirror.h"
+
+#include <algorithm>
+
+namespace aquafs {
+
+MirrorReadPolicy mirror_read_policy_from_str(const std::string &str) {
+  if (str == "round-robin") return MirrorReadPolicy::kRoundRobin;
+  if (str == "split") return MirrorReadPolicy::kSplit;
+  return MirrorReadPolicy::kLeastOutstanding;
+}
+
+const char *mirror_read_policy_str(MirrorReadPolicy policy) {
+  switch (policy) {
+    case MirrorReadPolicy::kRoundRobin:
+      return "round-robin";
+    case MirrorReadPolicy::kSplit:
+      return "split";
+    default:
+      return "least-outstanding";
+  }
+}
+
+MirrorReadScheduler::MirrorReadScheduler(size_t nr_dev,
+                                         MirrorReadPolicy policy)
+    : policy_(policy),
+      outstanding_(std::make_unique<std::atomic<uint32_t>[]>(nr_dev)),
+      failed_(std::make_unique<std::atomic<bool>[]>(nr_dev)) {
+  for (size_t i = 0; i < nr_dev; i++) {
+    outstanding_[i] = 0;
+    failed_[i] = false;
+  }
+}
+
+size_t MirrorReadScheduler::Order(std::vector<RaidMirror> &mirrors) {
+  auto healthy = static_cast<size_t>(
+      std::stable_partition(mirrors.begin(), mirrors.end(),
+                            [&](const RaidMirror &m) {
+                              return !failed_[m.device_idx];
+                            }) -
+      mirrors.begin());
+  // choose among the mirrors not failed, or among all if every one has
+  auto nr = healthy > 0 ? healthy : mirrors.size();
+  if (nr < 2) return healthy;
+  size_t best = 0;
+  if (policy_ == MirrorReadPolicy::kRoundRobin) {
+    best = next_++ % nr;
+  } else {
+    // split reads too small to be cut also go to the least busy mirror;
+    // ties rotate so idle mirrors share the load
+    auto start = next_++ % nr;
+    uint32_t best_outstanding = UINT32_MAX;
+    for (size_t i = 0; i < nr; i++) {
+      auto idx = (start + i) % nr;
+      uint32_t n = outstanding_[mirrors[idx].device_idx];
+      if (n < best_outstanding) {
+        best_outstanding = n;
+        best = idx;
+      }
+    }
+  }
+  std::rotate(mirrors.begin(), mirrors.begin() + static_cast<long>(best),
+              mirrors.begin() + static_cast<long>(best) + 1);
+  return healthy;
+}
+
+}  // namespace aquafs
@@ -0,0 +1,62 @@
+#ifndef ROCKSDB_ZONE_MIRROR_H
+#define ROCKSDB_ZONE_MIRROR_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace aquafs {
+
+/* One copy of mirrored data: device index and position on that device */
+struct RaidMirror {
+  unsigned int device_idx;
+  uint64_t pos;
+};
+
+enum class MirrorReadPolicy {
+  // take turns between mirrors
+  kRoundRobin,
+  // the mirror with the fewest reads in flight
+  kLeastOutstanding,
+  // large reads are cut into one chunk per mirror, read concurrently
+  kSplit
+};
+
+/* "round-robin", "least-outstanding" or "split", least-outstanding if
+ * unknown */
+MirrorReadPolicy mirror_read_policy_from_str(const std::string &str);
+const char *mirror_read_policy_str(MirrorReadPolicy policy);
+
+/*
+ * Picks the mirror a read goes to. Keeps a count of reads in flight per
+ * device, which callers maintain with Begin() and End(), and whether the
+ * last read of a device failed, which callers record with Report().
+ */
+class MirrorReadScheduler {
+ public:
+  MirrorReadScheduler(size_t nr_dev, MirrorReadPolicy policy);
+
+  [[nodiscard]] MirrorReadPolicy policy() const { return policy_; }
+
+  /* Moves the preferred mirror to the front, the others stay in order as
+   * failover candidates. Mirrors whose last read failed go last and are
+   * preferred only if all have failed. Returns the number of mirrors not
+   * failed. */
+  size_t Order(std::vector<RaidMirror> &mirrors);
+
+  void Begin(unsigned int device_idx) { outstanding_[device_idx]++; }
+  void End(unsigned int device_idx) { outstanding_[device_idx]--; }
+  void Report(unsigned int device_idx, bool ok) { failed_[device_idx] = !ok; }
+
+ private:
+  MirrorReadPolicy policy_;
+  std::atomic<uint64_t> next_{0};
+  std::unique_ptr<std::atomic<uint32_t>[]> outstanding_;
+  std::unique_ptr<std::atomic<bool>[]> failed_;
+};
+
+}  // namespace aquafs
+
+#endif  // ROCKSDB_ZONE_MIRROR_H
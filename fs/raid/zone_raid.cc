@@ -4,10 +4,14 @@
 
 #include "zone_raid.h"
 
+#include <cerrno>
+#include <cstring>
 #include <memory>
 #include <queue>
 #include <utility>
 
+#include "../configuration.h"
+
 namespace aquafs {
 
 const char *raid_mode_str(RaidMode mode) {
@@ -77,6 +81,8 @@ AbstractRaidZonedBlockDevice::AbstractRaidZonedBlockDevice(
   Info(logger_, "RAID Mode: raid%s Devices: ", raid_mode_str(main_mode_));
   assert(this->IsRAIDEnabled());
   for (auto &&d : devices_) Info(logger_, "  %s", d->GetFilename().c_str());
+  mirror_sched_ = std::make_unique<MirrorReadScheduler>(
+      devices_.size(), mirror_read_policy_from_str(FLAGS_raid1_read_policy));
 }
 
 IOStatus AbstractRaidZonedBlockDevice::Open(bool readonly, bool exclusive,
@@ -121,6 +127,190 @@ std::string AbstractRaidZonedBlockDevice::GetFilename() {
   }
   return name;
 }
+int AbstractRaidZonedBlockDevice::SubmitStriped(
+    const std::vector<RaidStripeUnit> &units, bool write, bool direct,
+    std::vector<bool> *failed_devs) {
+#ifdef AQUAFS_RAID_URING
+  // every unit is its own SQE, straight from the caller's buffer
+  bool coalesce = false;
+#else
+  // no bounce buffers before the device is open
+  bool coalesce = buffer_pool_ != nullptr;
+#endif
+
+  // a run of units which are contiguous on one device
+  struct Segment {
+    idx_t device_idx;
+    uint64_t pos;
+    uint32_t size;
+    std::vector<const RaidStripeUnit *> units;
+    IOBuffer bounce;
+  };
+  std::vector<Segment> segments;
+  std::vector<int> last_segment(nr_dev(), -1);
+  int total = 0;
+  for (const auto &u : units) {
+    auto last = last_segment[u.device_idx];
+    if (coalesce && last >= 0 &&
+        segments[last].pos + segments[last].size == u.pos) {
+      segments[last].size += u.size;
+      segments[last].units.push_back(&u);
+    } else {
+      last_segment[u.device_idx] = static_cast<int>(segments.size());
+      segments.push_back({u.device_idx, u.pos, u.size, {&u}, {}});
+    }
+    total += static_cast<int>(u.size);
+  }
+
+  // requests of a device keep the order of its segments, writes to the same
+  // device zone are linked so they land in order
+  auto dev_zone_sz = def_dev()->GetZoneSize();
+  std::vector<std::vector<ZoneIORequest>> reqs(nr_dev());
+  for (auto &seg : segments) {
+    auto &dev_reqs = reqs[seg.device_idx];
+    if (write && !dev_reqs.empty() &&
+        dev_reqs.back().pos / dev_zone_sz == seg.pos / dev_zone_sz)
+      dev_reqs.back().link = true;
+    ZoneIORequest req;
+    req.size = seg.size;
+    req.pos = seg.pos;
+    req.write = write;
+    req.direct = direct;
+    if (seg.units.size() == 1) {
+      req.buf = seg.units.front()->buf;
+    } else {
+      seg.bounce = buffer_pool_->Allocate(seg.size);
+      if (!seg.bounce) {
+        errno = ENOMEM;
+        return -1;
+      }
+      req.buf = seg.bounce.data();
+      if (write) {
+        char *p = req.buf;
+        for (auto u : seg.units) {
+          memcpy(p, u->buf, u->size);
+          p += u->size;
+        }
+      }
+    }
+    dev_reqs.push_back(req);
+  }
+
+  std::vector<std::unique_ptr<ZoneIOBatch>> batches;
+  for (size_t d = 0; d < nr_dev(); d++) {
+    if (reqs[d].empty()) continue;
+    batches.push_back(devices_[d]->SubmitIO(reqs[d].data(), reqs[d].size()));
+  }
+  for (auto &batch : batches) batch->Poll(true);
+
+  int r = total;
+  std::vector<size_t> next_req(nr_dev(), 0);
+  for (auto &seg : segments) {
+    auto &req = reqs[seg.device_idx][next_req[seg.device_idx]++];
+    if (req.result != static_cast<int>(req.size)) {
+      Error(logger_, "striped %s failed: dev=%x, pos=%lx, size=%x, r=%d",
+            write ? "write" : "read", seg.device_idx, seg.pos, seg.size,
+            req.result);
+      errno = req.result < 0 ? -req.result : EIO;
+      r = -1;
+      if (failed_devs != nullptr) (*failed_devs)[seg.device_idx] = true;
+      continue;
+    }
+    if (!write && seg.units.size() > 1) {
+      const char *p = req.buf;
+      for (auto u : seg.units) {
+        memcpy(u->buf, p, u->size);
+        p += u->size;
+      }
+    }
+  }
+  return r;
+}
+int AbstractRaidZonedBlockDevice::ReadMirrored(std::vector<RaidMirror> mirrors,
+                                               char *buf, int size,
+                                               bool direct) {
+  auto healthy = mirror_sched_->Order(mirrors);
+  if (mirror_sched_->policy() == MirrorReadPolicy::kSplit && healthy > 1 &&
+      size > 0 && static_cast<uint64_t>(size) >= FLAGS_raid1_split_min) {
+    // one block aligned chunk per mirror not failed, all in flight at once
+    auto blk = GetBlockSize();
+    uint32_t chunk = (size / healthy + blk - 1) / blk * blk;
+    std::vector<ZoneIORequest> reqs;
+    std::vector<const RaidMirror *> owners;
+    for (size_t i = 0; i < healthy; i++) {
+      const auto &m = mirrors[i];
+      uint32_t offset = chunk * reqs.size();
+      if (offset >= static_cast<uint32_t>(size)) break;
+      ZoneIORequest req;
+      req.buf = buf + offset;
+      req.size = std::min(chunk, static_cast<uint32_t>(size) - offset);
+      req.pos = m.pos + offset;
+      req.direct = direct;
+      reqs.push_back(req);
+      owners.push_back(&m);
+    }
+    std::vector<std::unique_ptr<ZoneIOBatch>> batches;
+    for (size_t i = 0; i < reqs.size(); i++) {
+      mirror_sched_->Begin(owners[i]->device_idx);
+      batches.push_back(
+          devices_[owners[i]->device_idx]->SubmitIO(&reqs[i], 1));
+    }
+    for (size_t i = 0; i < reqs.size(); i++) {
+      batches[i]->Poll(true);
+      mirror_sched_->End(owners[i]->device_idx);
+      mirror_sched_->Report(owners[i]->device_idx,
+                            reqs[i].result == static_cast<int>(reqs[i].size));
+    }
+    // chunks a mirror failed are read again from the others
+    for (size_t i = 0; i < reqs.size(); i++) {
+      if (reqs[i].result == static_cast<int>(reqs[i].size)) continue;
+      auto offset = static_cast<uint64_t>(reqs[i].buf - buf);
+      std::vector<RaidMirror> others;
+      for (const auto &m : mirrors)
+        if (&m != owners[i]) others.push_back({m.device_idx, m.pos + offset});
+      int r = ReadMirrored(std::move(others), reqs[i].buf,
+                           static_cast<int>(reqs[i].size), direct);
+      if (r != static_cast<int>(reqs[i].size)) return r < 0 ? r : -1;
+    }
+    return size;
+  }
+
+  int r = -1;
+  for (const auto &m : mirrors) {
+    mirror_sched_->Begin(m.device_idx);
+    r = devices_[m.device_idx]->Read(buf, size, m.pos, direct);
+    mirror_sched_->End(m.device_idx);
+    mirror_sched_->Report(m.device_idx, r > 0);
+    if (r > 0) return r;
+    Warn(logger_, "mirror read failed: dev=%x, pos=%lx, size=%x, r=%d",
+         m.device_idx, m.pos, size, r);
+  }
+  return r;
+}
+int AbstractRaidZonedBlockDevice::WriteMirrored(
+    const std::vector<RaidMirror> &mirrors, char *data, uint32_t size) {
+  std::vector<ZoneIORequest> reqs(mirrors.size());
+  for (size_t i = 0; i < mirrors.size(); i++) {
+    reqs[i].buf = data;
+    reqs[i].size = size;
+    reqs[i].pos = mirrors[i].pos;
+    reqs[i].write = true;
+  }
+  std::vector<std::unique_ptr<ZoneIOBatch>> batches;
+  for (size_t i = 0; i < mirrors.size(); i++)
+    batches.push_back(devices_[mirrors[i].device_idx]->SubmitIO(&reqs[i], 1));
+  for (auto &batch : batches) batch->Poll(true);
+
+  int r = static_cast<int>(size);
+  for (size_t i = 0; i < mirrors.size(); i++) {
+    if (reqs[i].result == static_cast<int>(size)) continue;
+    Error(logger_, "mirror write failed: dev=%x, pos=%lx, size=%x, r=%d",
+          mirrors[i].device_idx, mirrors[i].pos, size, reqs[i].result);
+    errno = reqs[i].result < 0 ? -reqs[i].result : EIO;
+    r = -1;
+  }
+  return r;
+}
 bool AbstractRaidZonedBlockDevice::IsRAIDEnabled() const { return true; }
 RaidMode AbstractRaidZonedBlockDevice::getMainMode() const {
   return main_mode_;
@@ -8,6 +8,7 @@
 
 #include "../zbd_aquafs.h"
 #include "../../base/io_status.h"
+#include "zone_mirror.h"
 
 
 namespace aquafs {
@@ -43,6 +44,7 @@ class RaidMapItem {
   uint16_t invalid{};
 
   Status DecodeFrom(Slice *input);
+  void EncodeTo(std::string *output) const;
 
   bool operator==(const RaidMapItem &rhs) const {
     return device_idx == rhs.device_idx && zone_idx == rhs.zone_idx;
@@ -57,6 +59,15 @@ class RaidModeItem {
   uint32_t option{};
 
   Status DecodeFrom(Slice *input);
+  void EncodeTo(std::string *output) const;
+};
+
+/* One stripe unit of a striped request, in device coordinates */
+struct RaidStripeUnit {
+  idx_t device_idx;
+  char *buf;
+  uint32_t size;
+  uint64_t pos;
 };
 
 class AbstractRaidZonedBlockDevice : public ZonedBlockDeviceBackend {
@@ -89,6 +100,39 @@ class AbstractRaidZonedBlockDevice : public ZonedBlockDeviceBackend {
 
   virtual void syncBackendInfo();
 
+  /*
+   * Issues the stripe units of one request. Units which are contiguous on a
+   * device are coalesced into one I/O through a bounce buffer, and the I/Os
+   * of all devices are submitted before any of them is waited for, so they
+   * run concurrently on devices with an asynchronous engine. Built with
+   * AQUAFS_RAID_URING, units go to the rings uncopied, one SQE each, and
+   * writes to a device zone are linked.
+   * Returns the bytes transferred, or a negative value on error. If
+   * failed_devs is given, the devices with a failed request are set in it.
+   */
+  int SubmitStriped(const std::vector<RaidStripeUnit> &units, bool write,
+                    bool direct, std::vector<bool> *failed_devs = nullptr);
+
+  std::unique_ptr<MirrorReadScheduler> mirror_sched_;
+
+  /*
+   * Reads size bytes which every one of mirrors holds. The scheduler picks
+   * the mirror, or cuts a large read across all of them under the split
+   * policy; a mirror failing the read falls over to the next one.
+   * Returns the bytes read, or the error of the last mirror tried.
+   */
+  int ReadMirrored(std::vector<RaidMirror> mirrors, char *buf, int size,
+                   bool direct);
+
+  /*
+   * Writes size bytes to every one of mirrors at once, one request per
+   * device, so a mirrored write takes as long as the slowest device. Each
+   * zone still sees a single sequential write. Returns size only if all
+   * mirrors wrote it in full, a negative value otherwise.
+   */
+  int WriteMirrored(const std::vector<RaidMirror> &mirrors, char *data,
+                    uint32_t size);
+
   template <class T>
   T nr_dev_t() const {
     return static_cast<T>(devices_.size());
@@ -4,16 +4,9 @@
 
 #include "zone_raid0.h"
 
-#ifdef AQUAFS_RAID_URING
 #include <algorithm>
-#include <ranges>
 #include <tuple>
 
-#include "../../liburing4cpp/include/liburing/io_service.hpp"
-#include "../aquafs_utils.h"
-#include "../zbdlib_aquafs.h"
-#endif
-
 namespace aquafs {
 void Raid0ZonedBlockDevice::syncBackendInfo() {
   AbstractRaidZonedBlockDevice::syncBackendInfo();
@@ -138,156 +131,32 @@ std::string to_string(const std::tuple<T...> &tup) {
 
 int Raid0ZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
                                 bool direct) {
-#ifndef AQUAFS_RAID_URING
-  // split read range as blocks
-  int sz_read = 0;
-  int r;
+  // split read range as blocks, issued to all devices at once
+  std::vector<RaidStripeUnit> units;
   while (size > 0) {
     auto req_size =
         std::min(size, static_cast<int>(GetBlockSize() - pos % GetBlockSize()));
-    r = devices_[get_idx_dev(pos)]->Read(buf, req_size, req_pos(pos), direct);
-    if (r > 0) {
-      size -= r;
-      sz_read += r;
-      buf += r;
-      pos += r;
-    } else {
-      return r;
-    }
-  }
-  return sz_read;
-#else
-  uio::io_service service;
-  // split read range as blocks
-  int sz_read = 0;
-  using req_item_t = std::tuple<int, char *, uint64_t, off_t>;
-  std::vector<req_item_t> requests;
-  std::vector<ZbdlibBackend *> bes(nr_dev());
-  for (decltype(nr_dev()) i = 0; i < nr_dev(); i++) {
-#ifdef ROCKSDB_USE_RTTI
-    bes[i] = dynamic_cast<ZbdlibBackend *>(devices_[i].get());
-    assert(bes[i] != nullptr);
-#else
-    bes[i] = (ZbdlibBackend *)(devices_[i].get());
-#endif
-  }
-  while (size > 0) {
-    auto req_size =
-        std::min(size, static_cast<int>(GetBlockSize() - pos % GetBlockSize()));
-    if (req_size == 0) break;
-    auto be = bes[get_idx_dev(pos)];
-    assert(be != nullptr);
-    int fd = direct ? be->read_direct_f_ : be->read_f_;
-    requests.emplace_back(fd, buf, req_size, req_pos(pos));
+    units.push_back({static_cast<idx_t>(get_idx_dev(pos)), buf,
+                     static_cast<uint32_t>(req_size), req_pos(pos)});
     size -= req_size;
-    sz_read += req_size;
     buf += req_size;
     pos += req_size;
   }
-  service.run([&]() -> uio::task<> {
-    std::vector<uio::task<int>> futures;
-    for (const auto &req : requests) {
-      uint8_t flags = 0;
-      // if (req != *requests.cend()) flags |= IOSQE_IO_LINK;
-      futures.emplace_back(service.read(std::get<0>(req), std::get<1>(req),
-                                        std::get<2>(req), std::get<3>(req),
-                                        flags) |
-                           uio::panic_on_err("failed to read!", true));
-    }
-    for (auto &&fut : futures) co_await fut;
-  }());
-#ifdef AQUAFS_SIM_DELAY
-  delay_us(calculate_delay_us(size / requests.size()));
-#endif
-  return sz_read;
-#endif
+  return SubmitStriped(units, false, direct);
 }
 int Raid0ZonedBlockDevice::Write(char *data, uint32_t size, uint64_t pos) {
-#ifndef AQUAFS_RAID_URING
-  // split read range as blocks
-  int sz_written = 0;
-  int r;
+  // split write range as blocks, issued to all devices at once
+  std::vector<RaidStripeUnit> units;
   while (size > 0) {
     auto req_size = std::min(
         size, GetBlockSize() - (static_cast<uint32_t>(pos)) % GetBlockSize());
-    auto p = req_pos(pos);
-    auto idx_dev = get_idx_dev(pos);
-    r = devices_[idx_dev]->Write(data, req_size, p);
-    // Debug(logger_, "WRITE: pos=%lx, dev=%lu, req_sz=%x, req_pos=%lx,
-    // ret=%d",
-    //       pos, idx_dev, req_size, p, r);
-    if (r > 0) {
-      size -= r;
-      sz_written += r;
-      data += r;
-      pos += r;
-    } else {
-      return r;
-    }
-  }
-  return sz_written;
-#else
-  uio::io_service service;
-  uint32_t sz_written = 0;
-  using req_item_t = std::tuple<char *, uint64_t, off_t>;
-  std::map<std::pair<int, idx_t>, std::vector<req_item_t>> requests;
-  std::vector<ZbdlibBackend *> bes(nr_dev());
-  for (decltype(nr_dev()) i = 0; i < nr_dev(); i++) {
-#ifdef ROCKSDB_USE_RTTI
-    bes[i] = dynamic_cast<ZbdlibBackend *>(devices_[i].get());
-    assert(bes[i] != nullptr);
-#else
-    bes[i] = (ZbdlibBackend *)(devices_[i].get());
-#endif
-  }
-  while (size > 0) {
-    auto req_size = std::min(
-        size, GetBlockSize() - (static_cast<uint32_t>(pos)) % GetBlockSize());
-    int fd = bes[get_idx_dev(pos)]->write_f_;
-    auto mapped_pos = req_pos(pos);
-    requests[{fd, mapped_pos / def_dev()->GetZoneSize()}].emplace_back(
-        data, req_size, mapped_pos);
+    units.push_back({static_cast<idx_t>(get_idx_dev(pos)), data, req_size,
+                     req_pos(pos)});
     size -= req_size;
-    sz_written += req_size;
     data += req_size;
     pos += req_size;
   }
-  service.run([&]() -> uio::task<> {
-    // std::vector<uio::task<int>> futures;
-    std::vector<uio::sqe_awaitable> futures;
-    for (const auto &req_list : requests) {
-      for (auto &&req : req_list.second) {
-        uint8_t flags = 0;
-        // if (req != *req_list.second.cend()) flags |= IOSQE_IO_LINK;
-        futures.emplace_back(
-            service.write(req_list.first.first, std::get<0>(req),
-                          std::get<1>(req), std::get<2>(req), flags)
-            // |uio::panic_on_err("failed to write!", true)
-        );
-        // futures.emplace_back(
-        // co_await service.fsync(req_list.first, 0, flags);
-        // );
-        // pwrite(req_list.first, std::get<0>(req), std::get<1>(req),
-        //        std::get<2>(req));
-      }
-    }
-#ifdef AQUAFS_SIM_DELAY
-    delay_us(calculate_delay_us(size / requests.size()));
-#endif
-    // // FIXME: WTF...?
-    // for (auto &&fut : futures) {
-    //   // printf("awaiting...\n");
-    //   // fflush(stdout);
-    //   // delay_ms(1);
-    //   delay_us(0);
-    //   // co_await fut | uio::panic_on_err("failed to write!", true);
-    //   co_await fut;
-    //   break;
-    // }
-    co_return;
-  }());
-  return static_cast<int>(sz_written);
-#endif
+  return SubmitStriped(units, true, false);
 }
 int Raid0ZonedBlockDevice::InvalidateCache(uint64_t pos, uint64_t size) {
   assert(size % GetBlockSize() == 0);
@@ -43,22 +43,14 @@ IOStatus Raid1ZonedBlockDevice::Close(uint64_t start) {
 }
 int Raid1ZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
                                 bool direct) {
-  int r = 0;
-  for (auto &&d : devices_) {
-    if ((r = d->Read(buf, size, pos, direct))) {
-      return r;
-    }
-  }
-  return r;
+  std::vector<RaidMirror> mirrors;
+  for (idx_t i = 0; i < nr_dev(); i++) mirrors.push_back({i, pos});
+  return ReadMirrored(std::move(mirrors), buf, size, direct);
 }
 int Raid1ZonedBlockDevice::Write(char *data, uint32_t size, uint64_t pos) {
-  int r = 0;
-  for (auto &&d : devices_) {
-    if ((r = d->Write(data, size, pos))) {
-      return r;
-    }
-  }
-  return r;
+  std::vector<RaidMirror> mirrors;
+  for (idx_t i = 0; i < nr_dev(); i++) mirrors.push_back({i, pos});
+  return WriteMirrored(mirrors, data, size);
 }
 int Raid1ZonedBlockDevice::InvalidateCache(uint64_t pos, uint64_t size) {
   int r = 0;
@@ -0,0 +1,265 @@
+#include "zone_raid10.h"
+
+#include <algorithm>
+
+#include "../zbdlib_aquafs.h"
+
+namespace aquafs {
+void Raid10ZonedBlockDevice::syncBackendInfo() {
+  AbstractRaidZonedBlockDevice::syncBackendInfo();
+  zone_sz_ *= nr_pairs();
+}
+Raid10ZonedBlockDevice::Raid10ZonedBlockDevice(
+    const std::shared_ptr<Logger> &logger,
+    std::vector<std::unique_ptr<ZonedBlockDeviceBackend>> &&devices)
+    : AbstractRaidZonedBlockDevice(logger, RaidMode::RAID10,
+                                   std::move(devices)),
+      failed_(std::make_unique<std::atomic<bool>[]>(nr_dev())) {
+  for (size_t i = 0; i < nr_dev(); i++) failed_[i] = false;
+  syncBackendInfo();
+}
+IOStatus Raid10ZonedBlockDevice::Open(bool readonly, bool exclusive,
+                                      unsigned int *max_active_zones,
+                                      unsigned int *max_open_zones) {
+  if (nr_dev() < 4 || nr_dev() % 2 != 0)
+    return IOStatus::InvalidArgument(
+        "raid10 needs an even number of devices, 4 at least");
+  // zone reports are merged as libzbd struct zbd_zone arrays
+  for (auto &&d : devices_) {
+    if (dynamic_cast<ZbdlibBackend *>(d.get()) == nullptr)
+      return IOStatus::InvalidArgument(
+          "raid10 needs libzbd devices (dev:<name>), " + d->GetFilename() +
+          " is not one");
+  }
+  return AbstractRaidZonedBlockDevice::Open(readonly, exclusive,
+                                            max_active_zones, max_open_zones);
+}
+std::unique_ptr<ZoneList> Raid10ZonedBlockDevice::ListZones() {
+  std::vector<std::unique_ptr<ZoneList>> reports(nr_dev());
+  for (idx_t d = 0; d < nr_dev(); d++) {
+    for (int i = 0; i < 2 && !failed_[d] && !reports[d]; i++)
+      reports[d] = devices_[d]->ListZones();
+    if (!reports[d]) mark_failed(d);
+  }
+  auto zone_written = [&](idx_t d, unsigned int i) {
+    return devices_[d]->ZoneWp(reports[d], i) -
+           devices_[d]->ZoneStart(reports[d], i);
+  };
+  // either device of a pair speaks for both, the first one if it answers
+  std::vector<idx_t> speaker(nr_pairs());
+  for (idx_t p = 0; p < nr_pairs(); p++) {
+    speaker[p] = reports[2 * p] ? 2 * p : 2 * p + 1;
+    if (!reports[speaker[p]]) {
+      Error(logger_, "raid10: no device of pair %x answers", p);
+      return nullptr;
+    }
+  }
+  auto nr_zones = reports[speaker[0]]->ZoneCount();
+  // a mirror behind the other one missed writes
+  for (idx_t p = 0; p < nr_pairs(); p++) {
+    if (!reports[2 * p] || !reports[2 * p + 1]) continue;
+    for (decltype(nr_zones) i = 0; i < nr_zones; i++) {
+      auto a = zone_written(2 * p, i), b = zone_written(2 * p + 1, i);
+      if (a == b) continue;
+      auto behind = a < b ? 2 * p : 2 * p + 1;
+      mark_failed(behind);
+      speaker[p] = behind ^ 1;
+      break;
+    }
+  }
+  auto data = new struct zbd_zone[nr_zones];
+  memcpy(data, reports[speaker[0]]->GetData(),
+         sizeof(struct zbd_zone) * nr_zones);
+  for (decltype(nr_zones) i = 0; i < nr_zones; i++) {
+    uint64_t written = 0;
+    for (idx_t p = 0; p < nr_pairs(); p++)
+      written += zone_written(speaker[p], i);
+    data[i].start *= nr_pairs();
+    data[i].capacity *= nr_pairs();
+    data[i].len *= nr_pairs();
+    data[i].wp = data[i].start + written;
+  }
+  return std::make_unique<ZoneList>(data, nr_zones);
+}
+void Raid10ZonedBlockDevice::mark_failed(idx_t device_idx) {
+  if (failed_[device_idx].exchange(true)) return;
+  Error(logger_, "raid10: %s dropped, its pair runs on %s alone",
+        devices_[device_idx]->GetFilename().c_str(),
+        devices_[device_idx ^ 1]->GetFilename().c_str());
+}
+template <typename Op>
+IOStatus Raid10ZonedBlockDevice::for_each_live(const char *what, Op op) {
+  IOStatus r{};
+  for (idx_t p = 0; p < nr_pairs(); p++) {
+    bool done = false;
+    for (idx_t d = 2 * p; d <= 2 * p + 1; d++) {
+      if (failed_[d]) continue;
+      auto s = op(d);
+      if (s.ok()) {
+        done = true;
+      } else {
+        Error(logger_, "raid10: %s failed on %s: %s", what,
+              devices_[d]->GetFilename().c_str(), s.ToString().c_str());
+        mark_failed(d);
+        r = s;
+      }
+    }
+    if (!done) return r.ok() ? IOStatus::IOError("raid10: pair lost") : r;
+  }
+  return IOStatus::OK();
+}
+IOStatus Raid10ZonedBlockDevice::Reset(uint64_t start, bool *offline,
+                                       uint64_t *max_capacity) {
+  assert(start % GetZoneSize() == 0);
+  auto s = start / nr_pairs();
+  auto r = for_each_live("reset", [&](idx_t d) {
+    return devices_[d]->Reset(s, offline, max_capacity);
+  });
+  if (!r.ok()) return r;
+  *max_capacity *= nr_pairs();
+  return r;
+}
+IOStatus Raid10ZonedBlockDevice::Finish(uint64_t start) {
+  assert(start % GetZoneSize() == 0);
+  auto s = start / nr_pairs();
+  return for_each_live("finish",
+                       [&](idx_t d) { return devices_[d]->Finish(s); });
+}
+IOStatus Raid10ZonedBlockDevice::Close(uint64_t start) {
+  assert(start % GetZoneSize() == 0);
+  auto s = start / nr_pairs();
+  return for_each_live("close",
+                       [&](idx_t d) { return devices_[d]->Close(s); });
+}
+int Raid10ZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
+                                 bool direct) {
+  // one mirror of each pair serves the whole request, so a device sees a
+  // single contiguous read
+  std::vector<idx_t> chosen(nr_pairs());
+  for (idx_t p = 0; p < nr_pairs(); p++) {
+    if (failed_[2 * p] || failed_[2 * p + 1]) {
+      chosen[p] = failed_[2 * p] ? 2 * p + 1 : 2 * p;
+      continue;
+    }
+    std::vector<RaidMirror> mirrors{{2 * p, 0}, {2 * p + 1, 0}};
+    mirror_sched_->Order(mirrors);
+    chosen[p] = mirrors.front().device_idx;
+  }
+  std::vector<RaidStripeUnit> units;
+  std::vector<bool> used(nr_pairs(), false);
+  while (size > 0) {
+    auto req_size =
+        std::min(size, static_cast<int>(GetBlockSize() - pos % GetBlockSize()));
+    auto pair = get_idx_pair(pos);
+    used[pair] = true;
+    units.push_back({chosen[pair], buf, static_cast<uint32_t>(req_size),
+                     req_pos(pos)});
+    size -= req_size;
+    buf += req_size;
+    pos += req_size;
+  }
+  for (idx_t p = 0; p < nr_pairs(); p++)
+    if (used[p]) mirror_sched_->Begin(chosen[p]);
+  auto r = SubmitStriped(units, false, direct);
+  for (idx_t p = 0; p < nr_pairs(); p++) {
+    if (!used[p]) continue;
+    mirror_sched_->End(chosen[p]);
+    if (r >= 0) mirror_sched_->Report(chosen[p], true);
+  }
+  if (r >= 0) return r;
+
+  // fall over unit by unit, each from whichever mirror of its pair answers;
+  // ReadMirrored records which device failed
+  int total = 0;
+  for (const auto &u : units) {
+    std::vector<RaidMirror> mirrors{{u.device_idx, u.pos}};
+    if (!failed_[u.device_idx ^ 1])
+      mirrors.push_back({u.device_idx ^ 1, u.pos});
+    auto n = ReadMirrored(std::move(mirrors), u.buf, static_cast<int>(u.size),
+                          direct);
+    if (n != static_cast<int>(u.size)) return n < 0 ? n : -1;
+    total += n;
+  }
+  return total;
+}
+int Raid10ZonedBlockDevice::Write(char *data, uint32_t size, uint64_t pos) {
+  // every block goes to both devices of its pair, all in one submission;
+  // a pair with a dropped device is written on the other one alone
+  std::vector<RaidStripeUnit> units;
+  std::vector<bool> used(nr_pairs(), false);
+  int total = static_cast<int>(size);
+  while (size > 0) {
+    auto req_size = std::min(
+        size, GetBlockSize() - (static_cast<uint32_t>(pos)) % GetBlockSize());
+    auto pair = get_idx_pair(pos);
+    used[pair] = true;
+    for (idx_t d = 2 * pair; d <= 2 * pair + 1; d++)
+      if (!failed_[d]) units.push_back({d, data, req_size, req_pos(pos)});
+    size -= req_size;
+    data += req_size;
+    pos += req_size;
+  }
+  // the write holds as long as each pair has a mirror that took it
+  auto pair_lost = [&]() {
+    for (idx_t p = 0; p < nr_pairs(); p++)
+      if (used[p] && failed_[2 * p] && failed_[2 * p + 1]) return true;
+    return false;
+  };
+  if (pair_lost()) {
+    errno = EIO;
+    return -1;
+  }
+  std::vector<bool> write_failed(nr_dev(), false);
+  if (SubmitStriped(units, true, false, &write_failed) >= 0) return total;
+  // no device failed, the write was not submitted at all
+  if (std::find(write_failed.begin(), write_failed.end(), true) ==
+      write_failed.end())
+    return -1;
+  for (idx_t d = 0; d < nr_dev(); d++)
+    if (write_failed[d]) mark_failed(d);
+  if (pair_lost()) {
+    errno = EIO;
+    return -1;
+  }
+  return total;
+}
+int Raid10ZonedBlockDevice::InvalidateCache(uint64_t pos, uint64_t size) {
+  assert(size % GetBlockSize() == 0);
+  for (auto &&d : devices_) d->InvalidateCache(req_pos(pos), size / nr_pairs());
+  return 0;
+}
+bool Raid10ZonedBlockDevice::ZoneIsSwr(std::unique_ptr<ZoneList> &zones,
+                                       unsigned int idx) {
+  // asserts that all devices have the same zone layout
+  return def_dev()->ZoneIsSwr(zones, idx);
+}
+bool Raid10ZonedBlockDevice::ZoneIsOffline(std::unique_ptr<ZoneList> &zones,
+                                           unsigned int idx) {
+  return def_dev()->ZoneIsOffline(zones, idx);
+}
+bool Raid10ZonedBlockDevice::ZoneIsWritable(std::unique_ptr<ZoneList> &zones,
+                                            unsigned int idx) {
+  return def_dev()->ZoneIsWritable(zones, idx);
+}
+bool Raid10ZonedBlockDevice::ZoneIsActive(std::unique_ptr<ZoneList> &zones,
+                                          unsigned int idx) {
+  return def_dev()->ZoneIsActive(zones, idx);
+}
+bool Raid10ZonedBlockDevice::ZoneIsOpen(std::unique_ptr<ZoneList> &zones,
+                                        unsigned int idx) {
+  return def_dev()->ZoneIsOpen(zones, idx);
+}
+uint64_t Raid10ZonedBlockDevice::ZoneStart(std::unique_ptr<ZoneList> &zones,
+                                           unsigned int idx) {
+  // zones come scaled from ListZones()
+  return def_dev()->ZoneStart(zones, idx);
+}
+uint64_t Raid10ZonedBlockDevice::ZoneMaxCapacity(
+    std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+  return def_dev()->ZoneMaxCapacity(zones, idx);
+}
+uint64_t Raid10ZonedBlockDevice::ZoneWp(std::unique_ptr<ZoneList> &zones,
+                                        unsigned int idx) {
+  return def_dev()->ZoneWp(zones, idx);
+}
+}  // namespace aquafs
@@ -0,0 +1,82 @@
+#ifndef ROCKSDB_ZONE_RAID10_H
+#define ROCKSDB_ZONE_RAID10_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "zone_raid.h"
+
+namespace aquafs {
+
+/*
+ * RAID10: devices 2i and 2i + 1 mirror each other, and blocks are striped
+ * over the pairs as in RAID0. Writes go to both devices of a pair in one
+ * striped submission; reads pick one mirror per pair with the mirror read
+ * scheduler and fall over to the other mirror unit by unit.
+ *
+ * A device that fails a write or a zone report is dropped from its pair:
+ * it gets no more I/O, and its pair keeps taking writes on the other
+ * mirror alone. Writes fail only when both devices of a pair are dropped.
+ * A dropped device is out of sync until it is rebuilt, there is no resync;
+ * at mount, a device behind its mirror in some zone is dropped again, but
+ * one that missed a reset cannot be told apart, so replace dropped devices
+ * before mounting again.
+ * All devices must be libzbd devices.
+ */
+class Raid10ZonedBlockDevice : public AbstractRaidZonedBlockDevice {
+ public:
+  Raid10ZonedBlockDevice(
+      const std::shared_ptr<Logger> &logger,
+      std::vector<std::unique_ptr<ZonedBlockDeviceBackend>> &&devices);
+
+  IOStatus Open(bool readonly, bool exclusive, unsigned int *max_active_zones,
+                unsigned int *max_open_zones) override;
+  std::unique_ptr<ZoneList> ListZones() override;
+  IOStatus Reset(uint64_t start, bool *offline,
+                 uint64_t *max_capacity) override;
+  IOStatus Finish(uint64_t start) override;
+  IOStatus Close(uint64_t start) override;
+  int Read(char *buf, int size, uint64_t pos, bool direct) override;
+  int Write(char *data, uint32_t size, uint64_t pos) override;
+  int InvalidateCache(uint64_t pos, uint64_t size) override;
+  bool ZoneIsSwr(std::unique_ptr<ZoneList> &zones, unsigned int idx) override;
+  bool ZoneIsOffline(std::unique_ptr<ZoneList> &zones,
+                     unsigned int idx) override;
+  bool ZoneIsWritable(std::unique_ptr<ZoneList> &zones,
+                      unsigned int idx) override;
+  bool ZoneIsActive(std::unique_ptr<ZoneList> &zones,
+                    unsigned int idx) override;
+  bool ZoneIsOpen(std::unique_ptr<ZoneList> &zones, unsigned int idx) override;
+  uint64_t ZoneStart(std::unique_ptr<ZoneList> &zones,
+                     unsigned int idx) override;
+  uint64_t ZoneMaxCapacity(std::unique_ptr<ZoneList> &zones,
+                           unsigned int idx) override;
+  uint64_t ZoneWp(std::unique_ptr<ZoneList> &zones, unsigned int idx) override;
+
+ protected:
+  void syncBackendInfo() override;
+
+ private:
+  /* Devices dropped from their pair */
+  std::unique_ptr<std::atomic<bool>[]> failed_;
+
+  [[nodiscard]] idx_t nr_pairs() const { return nr_dev_t<idx_t>() / 2; }
+  void mark_failed(idx_t device_idx);
+  /* Runs op on the devices of every pair not dropped, failing if a pair
+   * has none left or op fails on one of them */
+  template <typename Op>
+  IOStatus for_each_live(const char *what, Op op);
+  /* Pair a logical position is striped to */
+  [[nodiscard]] idx_t get_idx_pair(uint64_t pos) const {
+    return static_cast<idx_t>(pos / GetBlockSize() % nr_pairs());
+  }
+  /* Position on both devices of that pair */
+  [[nodiscard]] uint64_t req_pos(uint64_t pos) const {
+    auto blk_offset = pos % GetBlockSize();
+    return blk_offset + pos / GetBlockSize() / nr_pairs() * GetBlockSize();
+  }
+};
+
+}  // namespace aquafs
+
+#endif  // ROCKSDB_ZONE_RAID10_H
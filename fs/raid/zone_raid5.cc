@@ -0,0 +1,507 @@
+#include "zone_raid5.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "../zbdlib_aquafs.h"
+#include "zone_raid_parity.h"
+
+namespace aquafs {
+void Raid5ZonedBlockDevice::syncBackendInfo() {
+  AbstractRaidZonedBlockDevice::syncBackendInfo();
+  zone_sz_ *= nr_data();
+}
+Raid5ZonedBlockDevice::Raid5ZonedBlockDevice(
+    const std::shared_ptr<Logger> &logger, RaidMode mode,
+    std::vector<std::unique_ptr<ZonedBlockDeviceBackend>> &&devices)
+    : AbstractRaidZonedBlockDevice(logger, mode, std::move(devices)),
+      nr_parity_(mode == RaidMode::RAID6 ? 2 : 1),
+      failed_(std::make_unique<std::atomic<bool>[]>(nr_dev())) {
+  assert(mode == RaidMode::RAID5 || mode == RaidMode::RAID6);
+  for (size_t i = 0; i < nr_dev(); i++) failed_[i] = false;
+  syncBackendInfo();
+}
+IOStatus Raid5ZonedBlockDevice::Open(bool readonly, bool exclusive,
+                                     unsigned int *max_active_zones,
+                                     unsigned int *max_open_zones) {
+  // two data chunks a row at least, or it is a mirror; Q coefficients g^j
+  // repeat after 255 data chunks
+  if (nr_dev() < nr_parity_ + 2 || nr_data() > 255) {
+    return IOStatus::InvalidArgument(
+        std::string("raid") + raid_mode_str(main_mode_) + " needs " +
+        std::to_string(nr_parity_ + 2) + " to " +
+        std::to_string(nr_parity_ + 255) + " devices");
+  }
+  // zone reports are merged as libzbd struct zbd_zone arrays
+  for (auto &&d : devices_) {
+    if (dynamic_cast<ZbdlibBackend *>(d.get()) == nullptr)
+      return IOStatus::InvalidArgument(
+          std::string("raid") + raid_mode_str(main_mode_) +
+          " needs libzbd devices (dev:<name>), " + d->GetFilename() +
+          " is not one");
+  }
+  auto s = AbstractRaidZonedBlockDevice::Open(readonly, exclusive,
+                                              max_active_zones, max_open_zones);
+  if (!s.ok()) return s;
+  stripes_.clear();
+  for (uint32_t i = 0; i < nr_zones_; i++)
+    stripes_.push_back(std::make_unique<OpenStripe>());
+  return s;
+}
+std::unique_ptr<ZoneList> Raid5ZonedBlockDevice::ListZones() {
+  // the devices left speak for the failed ones
+  std::vector<std::unique_ptr<ZoneList>> reports(nr_dev());
+  std::vector<bool> known(nr_dev());
+  idx_t first = nr_dev_t<idx_t>();
+  for (idx_t d = 0; d < nr_dev(); d++) {
+    reports[d] = list_dev_zones(d);
+    known[d] = reports[d] != nullptr;
+    if (known[d] && first == nr_dev()) first = d;
+  }
+  if (nr_failed() > nr_parity_) {
+    Error(logger_, "raid%s: %u devices failed, cannot list zones",
+          raid_mode_str(main_mode_), nr_failed());
+    return nullptr;
+  }
+  auto nr_zones = reports[first]->ZoneCount();
+  auto data = new struct zbd_zone[nr_zones];
+  memcpy(data, reports[first]->GetData(), sizeof(struct zbd_zone) * nr_zones);
+  std::vector<uint64_t> written(nr_dev());
+  for (decltype(nr_zones) i = 0; i < nr_zones; i++) {
+    for (idx_t d = 0; d < nr_dev(); d++) {
+      if (!known[d]) continue;
+      written[d] = devices_[d]->ZoneWp(reports[d], i) -
+                   devices_[d]->ZoneStart(reports[d], i);
+    }
+    uint64_t row;
+    idx_t nr_filled;
+    find_open_row(written, known, &row, &nr_filled);
+    data[i].start *= nr_data();
+    data[i].capacity *= nr_data();
+    data[i].len *= nr_data();
+    data[i].wp = data[i].start + (row * nr_data() + nr_filled) * GetBlockSize();
+  }
+  return std::make_unique<ZoneList>(data, nr_zones);
+}
+IOStatus Raid5ZonedBlockDevice::Reset(uint64_t start, bool *offline,
+                                      uint64_t *max_capacity) {
+  assert(start % GetZoneSize() == 0);
+  auto &stripe = *stripes_[start / GetZoneSize()];
+  if (!writable())
+    return IOStatus::IOError("raid" + std::string(raid_mode_str(main_mode_)) +
+                             ": degraded, cannot reset");
+  std::lock_guard<std::mutex> lock(stripe.mtx);
+  // what a failed reset left behind is read back on the next write
+  stripe.loaded = false;
+  auto s = start / nr_data();
+  IOStatus r{};
+  for (auto &&d : devices_) {
+    r = d->Reset(s, offline, max_capacity);
+    if (!r.ok()) return r;
+  }
+  *max_capacity *= nr_data();
+  reset_stripe(stripe, 0);
+  stripe.loaded = true;
+  return r;
+}
+IOStatus Raid5ZonedBlockDevice::Finish(uint64_t start) {
+  assert(start % GetZoneSize() == 0);
+  auto zone = start / GetZoneSize();
+  auto &stripe = *stripes_[zone];
+  if (!writable())
+    return IOStatus::IOError("raid" + std::string(raid_mode_str(main_mode_)) +
+                             ": degraded, cannot finish");
+  std::lock_guard<std::mutex> lock(stripe.mtx);
+  if (!stripe.loaded && !load_stripe(zone, stripe))
+    return IOStatus::IOError("raid" + std::string(raid_mode_str(main_mode_)) +
+                             ": cannot load the open row");
+  if (stripe.nr_filled > 0) {
+    // the unwritten chunks of the row read back as zeros once finished, so
+    // the parity of the written ones covers the row
+    IOBuffer buf = buffer_pool_->Allocate(nr_parity_ * GetBlockSize());
+    if (!buf) return IOStatus::IOError("Allocate memory failed!");
+    std::vector<RaidStripeUnit> units;
+    add_parity_units(zone, stripe, buf.data(), units);
+    if (SubmitStriped(units, true, false) < 0)
+      return IOStatus::IOError("raid" + std::string(raid_mode_str(main_mode_)) +
+                               ": parity write failed");
+  }
+  stripe.loaded = false;
+  auto s = start / nr_data();
+  IOStatus r{};
+  for (auto &&d : devices_) {
+    r = d->Finish(s);
+    if (!r.ok()) return r;
+  }
+  // every row is closed, the open row is past the end of the zone
+  reset_stripe(stripe, dev_zone_sz() / GetBlockSize());
+  stripe.loaded = true;
+  return r;
+}
+IOStatus Raid5ZonedBlockDevice::Close(uint64_t start) {
+  assert(start % GetZoneSize() == 0);
+  auto s = start / nr_data();
+  IOStatus r{};
+  for (idx_t d = 0; d < nr_dev(); d++) {
+    // only releases an open zone resource, nothing to do on a failed device
+    if (failed_[d]) continue;
+    r = devices_[d]->Close(s);
+    if (!r.ok()) return r;
+  }
+  return r;
+}
+void Raid5ZonedBlockDevice::find_open_row(const std::vector<uint64_t> &written,
+                                          const std::vector<bool> &known,
+                                          uint64_t *row, idx_t *nr_filled) {
+  const uint64_t blk = GetBlockSize();
+  uint64_t r = UINT64_MAX;
+  for (idx_t d = 0; d < nr_dev(); d++)
+    if (known[d]) r = std::min(r, written[d] / blk);
+  // a chunk on an unknown device counts as written if a later one is
+  idx_t n = 0;
+  for (idx_t j = 0; j < nr_data(); j++) {
+    auto d = data_dev(r, j);
+    if (!known[d]) continue;
+    if (written[d] <= r * blk) break;
+    n = j + 1;
+  }
+  *row = r;
+  *nr_filled = n;
+}
+bool Raid5ZonedBlockDevice::load_stripe(uint64_t zone, OpenStripe &s) {
+  const uint64_t blk = GetBlockSize();
+  auto idx = static_cast<unsigned int>(zone);
+  std::vector<uint64_t> written(nr_dev());
+  std::vector<bool> known(nr_dev());
+  for (idx_t d = 0; d < nr_dev(); d++) {
+    auto zones = list_dev_zones(d);
+    if (!zones) continue;
+    known[d] = true;
+    written[d] = devices_[d]->ZoneWp(zones, idx) -
+                 devices_[d]->ZoneStart(zones, idx);
+  }
+  if (nr_failed() > nr_parity_) return false;
+  uint64_t row;
+  idx_t nr_filled;
+  find_open_row(written, known, &row, &nr_filled);
+  reset_stripe(s, row);
+  s.nr_filled = nr_filled;
+  if (s.nr_filled > 0) {
+    std::vector<char> chunk(blk);
+    auto pos = zone * dev_zone_sz() + s.row * blk;
+    for (idx_t j = 0; j < s.nr_filled; j++) {
+      if (!read_dev(data_dev(s.row, j), chunk.data(), blk, pos, false)) {
+        // the parity of the open row was only in memory before; the rows
+        // before it can still be rebuilt
+        s.parity_lost = true;
+        break;
+      }
+      parity_xor(s.p.data(), chunk.data(), blk);
+      if (nr_parity_ > 1)
+        parity_gf_mul_xor(s.q.data(), chunk.data(), gf_exp(j), blk);
+    }
+  }
+  // while degraded the row waits for the failed devices to come back, the
+  // open rows are loaded again then
+  if (s.nr_filled == nr_data() && !degraded_) {
+    // cut off between the data and the parity of the row
+    IOBuffer buf = buffer_pool_->Allocate(nr_parity_ * blk);
+    if (!buf) return false;
+    std::vector<RaidStripeUnit> units;
+    add_parity_units(zone, s, buf.data(), units);
+    if (SubmitStriped(units, true, false) < 0) return false;
+  }
+  s.loaded = true;
+  return true;
+}
+void Raid5ZonedBlockDevice::reset_stripe(OpenStripe &s, uint64_t row) {
+  s.row = row;
+  s.nr_filled = 0;
+  s.p.assign(GetBlockSize(), 0);
+  s.q.assign(nr_parity_ > 1 ? GetBlockSize() : 0, 0);
+  s.parity_lost = false;
+}
+void Raid5ZonedBlockDevice::add_parity_units(
+    uint64_t zone, OpenStripe &s, char *buf,
+    std::vector<RaidStripeUnit> &units) {
+  const auto blk = GetBlockSize();
+  auto pos = zone * dev_zone_sz() + s.row * blk;
+  memcpy(buf, s.p.data(), blk);
+  units.push_back({parity_dev(s.row, 0), buf, blk, pos});
+  if (nr_parity_ > 1) {
+    memcpy(buf + blk, s.q.data(), blk);
+    units.push_back({parity_dev(s.row, 1), buf + blk, blk, pos});
+  }
+  s.row++;
+  s.nr_filled = 0;
+  std::fill(s.p.begin(), s.p.end(), 0);
+  std::fill(s.q.begin(), s.q.end(), 0);
+}
+int Raid5ZonedBlockDevice::Write(char *data, uint32_t size, uint64_t pos) {
+  const uint32_t blk = GetBlockSize();
+  const idx_t k = nr_data();
+  auto zone = pos / GetZoneSize();
+  auto off = pos % GetZoneSize();
+  if (size % blk != 0 || off % blk != 0 || off + size > GetZoneSize() ||
+      zone >= stripes_.size()) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (!writable()) {
+    // the chunks of a failed device cannot be written, rebuild it first
+    errno = EIO;
+    return -1;
+  }
+  auto &s = *stripes_[zone];
+  std::lock_guard<std::mutex> lock(s.mtx);
+  if (!s.loaded && !load_stripe(zone, s)) {
+    errno = EIO;
+    return -1;
+  }
+  if (off != (s.row * k + s.nr_filled) * blk) {
+    Error(logger_, "raid%s: write at %lx, zone wp at %lx",
+          raid_mode_str(main_mode_), pos,
+          zone * GetZoneSize() + (s.row * k + s.nr_filled) * blk);
+    errno = EINVAL;
+    return -1;
+  }
+
+  // parity of every row this write completes, at most one more than the
+  // full rows it holds
+  IOBuffer parity =
+      buffer_pool_->Allocate((size / (k * blk) + 1) * nr_parity_ * blk);
+  if (!parity) {
+    errno = ENOMEM;
+    return -1;
+  }
+  char *pp = parity.data();
+  std::vector<RaidStripeUnit> units;
+  std::vector<const char *> row_data(k);
+  auto dev_base = zone * dev_zone_sz();
+  for (uint32_t done = 0; done < size;) {
+    auto dev_pos = dev_base + s.row * blk;
+    if (s.nr_filled == 0 && size - done >= k * blk) {
+      // a full row, its parity straight from the data
+      for (idx_t j = 0; j < k; j++) {
+        row_data[j] = data + done + j * blk;
+        units.push_back({data_dev(s.row, j), data + done + j * blk, blk,
+                         dev_pos});
+      }
+      parity_gen(row_data, blk, pp, nr_parity_ > 1 ? pp + blk : nullptr);
+      for (idx_t i = 0; i < nr_parity_; i++)
+        units.push_back({parity_dev(s.row, i), pp + i * blk, blk, dev_pos});
+      pp += nr_parity_ * blk;
+      s.row++;
+      done += k * blk;
+      continue;
+    }
+    char *chunk = data + done;
+    parity_xor(s.p.data(), chunk, blk);
+    if (nr_parity_ > 1)
+      parity_gf_mul_xor(s.q.data(), chunk, gf_exp(s.nr_filled), blk);
+    units.push_back({data_dev(s.row, s.nr_filled), chunk, blk, dev_pos});
+    done += blk;
+    if (++s.nr_filled == k) {
+      add_parity_units(zone, s, pp, units);
+      pp += nr_parity_ * blk;
+    }
+  }
+  if (SubmitStriped(units, true, false) < 0) {
+    // what reached the devices is unknown, read the row back next time
+    s.loaded = false;
+    return -1;
+  }
+  return static_cast<int>(size);
+}
+void Raid5ZonedBlockDevice::mark_failed(idx_t device_idx) {
+  if (failed_[device_idx].exchange(true)) return;
+  degraded_ = true;
+  Error(logger_,
+        "raid%s: %s failed, reads are rebuilt from parity and writes refused",
+        raid_mode_str(main_mode_),
+        devices_[device_idx]->GetFilename().c_str());
+}
+idx_t Raid5ZonedBlockDevice::nr_failed() const {
+  idx_t n = 0;
+  for (idx_t d = 0; d < nr_dev(); d++) n += failed_[d] ? 1 : 0;
+  return n;
+}
+std::unique_ptr<ZoneList> Raid5ZonedBlockDevice::list_dev_zones(
+    idx_t device_idx) {
+  for (int i = 0; i < kAttempts && !failed_[device_idx]; i++) {
+    auto zones = devices_[device_idx]->ListZones();
+    if (zones) return zones;
+  }
+  mark_failed(device_idx);
+  return nullptr;
+}
+bool Raid5ZonedBlockDevice::read_dev(idx_t device_idx, char *buf,
+                                     uint32_t size, uint64_t pos,
+                                     bool direct) {
+  for (int i = 0; i < kAttempts && !failed_[device_idx]; i++) {
+    if (devices_[device_idx]->Read(buf, static_cast<int>(size), pos,
+                                   direct) == static_cast<int>(size))
+      return true;
+  }
+  mark_failed(device_idx);
+  return false;
+}
+bool Raid5ZonedBlockDevice::writable() {
+  if (!degraded_) return true;
+  {
+    std::lock_guard<std::mutex> lock(probe_mtx_);
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_probe_) return false;
+    next_probe_ = now + std::chrono::seconds(1);
+  }
+  bool back = false;
+  for (idx_t d = 0; d < nr_dev(); d++) {
+    if (!failed_[d] || !devices_[d]->ListZones()) continue;
+    Info(logger_, "raid%s: %s answers again", raid_mode_str(main_mode_),
+         devices_[d]->GetFilename().c_str());
+    failed_[d] = false;
+    back = true;
+  }
+  if (!back) return false;
+  // open rows were loaded without the failed devices, read them again
+  for (auto &s : stripes_) {
+    std::lock_guard<std::mutex> lock(s->mtx);
+    s->loaded = false;
+  }
+  degraded_ = nr_failed() > 0;
+  return !degraded_;
+}
+bool Raid5ZonedBlockDevice::rebuild_chunk(uint64_t zone, uint64_t row,
+                                          idx_t j, char *out) {
+  const uint32_t blk = GetBlockSize();
+  const idx_t k = nr_data();
+  auto &s = *stripes_[zone];
+  std::lock_guard<std::mutex> lock(s.mtx);
+  if (!s.loaded && !load_stripe(zone, s)) return false;
+  if (row > s.row || (row == s.row && s.parity_lost)) return false;
+
+  IOBuffer buf = buffer_pool_->Allocate((k + nr_parity_) * blk);
+  if (!buf) return false;
+  std::vector<char *> chunks;
+  for (idx_t c = 0; c < k + nr_parity_; c++)
+    chunks.push_back(buf.data() + c * blk);
+
+  // the open row has its parity in memory and no data past nr_filled
+  bool open_row = row == s.row;
+  std::vector<size_t> lost{j};
+  auto pos = zone * dev_zone_sz() + row * blk;
+  for (idx_t c = 0; c < k + nr_parity_; c++) {
+    if (c == j) continue;
+    if (open_row && c >= k) {
+      memcpy(chunks[c], c == k ? s.p.data() : s.q.data(), blk);
+      continue;
+    }
+    if (open_row && c >= s.nr_filled) {
+      memset(chunks[c], 0, blk);
+      continue;
+    }
+    auto d = c < k ? data_dev(row, c) : parity_dev(row, c - k);
+    if (!read_dev(d, chunks[c], blk, pos, false)) lost.push_back(c);
+  }
+  if (!parity_rebuild(chunks, k, blk, lost)) {
+    Error(logger_, "raid%s: %zu chunks of zone %lx row %lx lost",
+          raid_mode_str(main_mode_), lost.size(), zone, row);
+    return false;
+  }
+  memcpy(out, chunks[j], blk);
+  return true;
+}
+int Raid5ZonedBlockDevice::read_degraded(
+    const std::vector<RaidStripeUnit> &units,
+    const std::vector<uint64_t> &zones, const std::vector<uint64_t> &rows,
+    const std::vector<idx_t> &chunks, bool direct) {
+  const uint32_t blk = GetBlockSize();
+  std::vector<char> block(blk);
+  int total = 0;
+  for (size_t i = 0; i < units.size(); i++) {
+    const auto &u = units[i];
+    if (read_dev(u.device_idx, u.buf, u.size, u.pos, direct)) {
+      total += static_cast<int>(u.size);
+      continue;
+    }
+    if (!rebuild_chunk(zones[i], rows[i], chunks[i], block.data())) {
+      errno = EIO;
+      return -1;
+    }
+    memcpy(u.buf, block.data() + u.pos % blk, u.size);
+    total += static_cast<int>(u.size);
+  }
+  return total;
+}
+int Raid5ZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
+                                bool direct) {
+  const uint32_t blk = GetBlockSize();
+  const idx_t k = nr_data();
+  // split read range as blocks, issued to all devices at once
+  std::vector<RaidStripeUnit> units;
+  std::vector<uint64_t> zones, rows;
+  std::vector<idx_t> chunks;
+  while (size > 0) {
+    auto req_size =
+        std::min(size, static_cast<int>(blk - pos % blk));
+    auto zone = pos / GetZoneSize();
+    auto block = (pos % GetZoneSize()) / blk;
+    auto row = block / k;
+    auto j = static_cast<idx_t>(block % k);
+    units.push_back({data_dev(row, j), buf, static_cast<uint32_t>(req_size),
+                     zone * dev_zone_sz() + row * blk + pos % blk});
+    zones.push_back(zone);
+    rows.push_back(row);
+    chunks.push_back(j);
+    size -= req_size;
+    buf += req_size;
+    pos += req_size;
+  }
+  if (!degraded_) {
+    auto r = SubmitStriped(units, false, direct);
+    if (r >= 0) return r;
+  }
+  return read_degraded(units, zones, rows, chunks, direct);
+}
+int Raid5ZonedBlockDevice::InvalidateCache(uint64_t pos, uint64_t size) {
+  assert(size % GetBlockSize() == 0);
+  for (size_t i = 0; i < nr_dev(); i++) {
+    devices_[i]->InvalidateCache(pos / nr_data(), size / nr_data());
+  }
+  return 0;
+}
+bool Raid5ZonedBlockDevice::ZoneIsSwr(std::unique_ptr<ZoneList> &zones,
+                                      unsigned int idx) {
+  // asserts that all devices have the same zone layout
+  return def_dev()->ZoneIsSwr(zones, idx);
+}
+bool Raid5ZonedBlockDevice::ZoneIsOffline(std::unique_ptr<ZoneList> &zones,
+                                          unsigned int idx) {
+  return def_dev()->ZoneIsOffline(zones, idx);
+}
+bool Raid5ZonedBlockDevice::ZoneIsWritable(std::unique_ptr<ZoneList> &zones,
+                                           unsigned int idx) {
+  return def_dev()->ZoneIsWritable(zones, idx);
+}
+bool Raid5ZonedBlockDevice::ZoneIsActive(std::unique_ptr<ZoneList> &zones,
+                                         unsigned int idx) {
+  return def_dev()->ZoneIsActive(zones, idx);
+}
+bool Raid5ZonedBlockDevice::ZoneIsOpen(std::unique_ptr<ZoneList> &zones,
+                                       unsigned int idx) {
+  return def_dev()->ZoneIsOpen(zones, idx);
+}
+uint64_t Raid5ZonedBlockDevice::ZoneStart(std::unique_ptr<ZoneList> &zones,
+                                          unsigned int idx) {
+  // zones come scaled from ListZones()
+  return def_dev()->ZoneStart(zones, idx);
+}
+uint64_t Raid5ZonedBlockDevice::ZoneMaxCapacity(
+    std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+  return def_dev()->ZoneMaxCapacity(zones, idx);
+}
+uint64_t Raid5ZonedBlockDevice::ZoneWp(std::unique_ptr<ZoneList> &zones,
+                                       unsigned int idx) {
+  return def_dev()->ZoneWp(zones, idx);
+}
+}  // namespace aquafs
@@ -0,0 +1,141 @@
+#ifndef ROCKSDB_ZONE_RAID5_H
+#define ROCKSDB_ZONE_RAID5_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include "zone_raid.h"
+
+namespace aquafs {
+
+/*
+ * RAID5, or RAID6 with a second parity chunk, over zoned devices.
+ *
+ * A logical zone is zone i of every device; each row of blocks across the
+ * device zones holds one block a data device plus P (and Q), which rotate
+ * over the devices row by row. Appends write their data chunks at once and
+ * the parity of a row once its last data chunk is written, so every device
+ * zone is still written sequentially. The parity of the open row is kept in
+ * memory until then; Finish writes it with the missing chunks taken as
+ * zeros, and after a restart it is read back from the written chunks.
+ *
+ * A device that fails a read or a zone report twice in a row is marked
+ * failed, and its chunks are rebuilt from the rest of the row from then on.
+ * Zone reports and open rows come from the devices that are left, so a
+ * degraded array still mounts. Writes, resets and finishes are refused while
+ * degraded; they probe the failed devices at most once a second and take
+ * back those that answer again, which missed no writes in between.
+ * All devices must be libzbd devices.
+ */
+class Raid5ZonedBlockDevice : public AbstractRaidZonedBlockDevice {
+ public:
+  /* mode is RaidMode::RAID5 or RaidMode::RAID6 */
+  Raid5ZonedBlockDevice(
+      const std::shared_ptr<Logger> &logger, RaidMode mode,
+      std::vector<std::unique_ptr<ZonedBlockDeviceBackend>> &&devices);
+
+  IOStatus Open(bool readonly, bool exclusive, unsigned int *max_active_zones,
+                unsigned int *max_open_zones) override;
+  std::unique_ptr<ZoneList> ListZones() override;
+  IOStatus Reset(uint64_t start, bool *offline,
+                 uint64_t *max_capacity) override;
+  IOStatus Finish(uint64_t start) override;
+  IOStatus Close(uint64_t start) override;
+  int Read(char *buf, int size, uint64_t pos, bool direct) override;
+  int Write(char *data, uint32_t size, uint64_t pos) override;
+  int InvalidateCache(uint64_t pos, uint64_t size) override;
+  bool ZoneIsSwr(std::unique_ptr<ZoneList> &zones, unsigned int idx) override;
+  bool ZoneIsOffline(std::unique_ptr<ZoneList> &zones,
+                     unsigned int idx) override;
+  bool ZoneIsWritable(std::unique_ptr<ZoneList> &zones,
+                      unsigned int idx) override;
+  bool ZoneIsActive(std::unique_ptr<ZoneList> &zones,
+                    unsigned int idx) override;
+  bool ZoneIsOpen(std::unique_ptr<ZoneList> &zones, unsigned int idx) override;
+  uint64_t ZoneStart(std::unique_ptr<ZoneList> &zones,
+                     unsigned int idx) override;
+  uint64_t ZoneMaxCapacity(std::unique_ptr<ZoneList> &zones,
+                           unsigned int idx) override;
+  uint64_t ZoneWp(std::unique_ptr<ZoneList> &zones, unsigned int idx) override;
+
+ protected:
+  void syncBackendInfo() override;
+
+ private:
+  /* The row of a zone being filled */
+  struct OpenStripe {
+    std::mutex mtx;
+    // false until read from the devices, which is needed only after a
+    // restart or a failed write
+    bool loaded = false;
+    uint64_t row = 0;
+    // data chunks of the row written so far
+    idx_t nr_filled = 0;
+    // parity of those chunks
+    std::vector<char> p, q;
+    // a written chunk of the row was on a failed device when it was
+    // loaded, so p and q are incomplete
+    bool parity_lost = false;
+  };
+
+  /* Tries of a device read or zone report before the device is failed */
+  static constexpr int kAttempts = 2;
+
+  idx_t nr_parity_;
+  std::vector<std::unique_ptr<OpenStripe>> stripes_;
+  std::unique_ptr<std::atomic<bool>[]> failed_;
+  std::atomic<bool> degraded_{false};
+  std::mutex probe_mtx_;
+  std::chrono::steady_clock::time_point next_probe_{};
+
+  [[nodiscard]] idx_t nr_data() const { return nr_dev_t<idx_t>() - nr_parity_; }
+  [[nodiscard]] uint64_t dev_zone_sz() const {
+    return def_dev()->GetZoneSize();
+  }
+  /* Device of parity chunk i (0 for P, 1 for Q) of a row */
+  [[nodiscard]] idx_t parity_dev(uint64_t row, idx_t i) const {
+    auto n = nr_dev_t<idx_t>();
+    return static_cast<idx_t>((n - 1 - row % n + i) % n);
+  }
+  /* Device of data chunk j of a row, the data follows the parity */
+  [[nodiscard]] idx_t data_dev(uint64_t row, idx_t j) const {
+    return (parity_dev(row, 0) + nr_parity_ + j) % nr_dev_t<idx_t>();
+  }
+
+  /* Makes row the open row, with no data written to it yet */
+  void reset_stripe(OpenStripe &s, uint64_t row);
+  /* Open row of a zone and its data chunks written, from the zone bytes
+   * written on each device; devices not known are skipped */
+  void find_open_row(const std::vector<uint64_t> &written,
+                     const std::vector<bool> &known, uint64_t *row,
+                     idx_t *nr_filled);
+  /* Reads the open row of a zone back from the devices, writing its parity
+   * if all its data made it but the parity did not */
+  bool load_stripe(uint64_t zone, OpenStripe &s);
+  /* Appends the parity units of the open row to units, copied to buf, and
+   * opens the next row */
+  void add_parity_units(uint64_t zone, OpenStripe &s, char *buf,
+                        std::vector<RaidStripeUnit> &units);
+  void mark_failed(idx_t device_idx);
+  [[nodiscard]] idx_t nr_failed() const;
+  /* Zone report of a device, nullptr if it is failed */
+  std::unique_ptr<ZoneList> list_dev_zones(idx_t device_idx);
+  /* Reads from a device, false if it is failed */
+  bool read_dev(idx_t device_idx, char *buf, uint32_t size, uint64_t pos,
+                bool direct);
+  /* Takes back failed devices that answer again, true if not degraded */
+  bool writable();
+  /* Rebuilds block chunk j of a row from the rest of the row */
+  bool rebuild_chunk(uint64_t zone, uint64_t row, idx_t j, char *out);
+  /* Reads units one by one, rebuilding those of failed devices */
+  int read_degraded(const std::vector<RaidStripeUnit> &units,
+                    const std::vector<uint64_t> &zones,
+                    const std::vector<uint64_t> &rows,
+                    const std::vector<idx_t> &chunks, bool direct);
+};
+
+}  // namespace aquafs
+
+#endif  // ROCKSDB_ZONE_RAID5_H
@@ -5,6 +5,22 @@
 #include "zone_raid_allocator.h"
 namespace aquafs {
 
+void ZoneRaidAllocator::growDevices(idx_t device) {
+  if (device < used_.size()) return;
+  used_.resize(device + 1);
+  offline_.resize(device + 1);
+  free_hint_.resize(device + 1, 0);
+}
+uint64_t ZoneRaidAllocator::takenWord(idx_t device, size_t w) const {
+  uint64_t taken = 0;
+  if (device < used_.size())
+    taken = used_[device].word(w) | offline_[device].word(w);
+  // zones past the end of the device are never free
+  uint64_t first = w * 64;
+  if (first >= zone_nr_) return ~0ULL;
+  if (zone_nr_ - first < 64) taken |= ~0ULL << (zone_nr_ - first);
+  return taken;
+}
 Status ZoneRaidAllocator::addMapping(idx_t logical_raid_zone_sub_idx,
                                      idx_t physical_device_idx,
                                      idx_t physical_zone_idx) {
@@ -14,10 +30,30 @@ Status ZoneRaidAllocator::addMapping(idx_t logical_raid_zone_sub_idx,
   auto item = RaidMapItem{physical_device_idx,
                           static_cast<idx_t>(physical_zone_idx), 0};
   device_zone_map_[logical_raid_zone_sub_idx].emplace_back(item);
-  device_zone_inv_map_[std::make_pair(physical_device_idx, physical_zone_idx)] =
-      logical_raid_zone_sub_idx;
+  growDevices(physical_device_idx);
+  used_[physical_device_idx].set(physical_zone_idx);
   return Status::OK();
 }
+void ZoneRaidAllocator::removeMapping(idx_t physical_device_idx,
+                                      idx_t physical_zone_idx) {
+  if (physical_device_idx >= used_.size()) return;
+  used_[physical_device_idx].clear(physical_zone_idx);
+  size_t w = physical_zone_idx / 64;
+  free_hint_[physical_device_idx] =
+      std::min(free_hint_[physical_device_idx], w);
+  any_free_hint_ = std::min(any_free_hint_, w);
+}
+void ZoneRaidAllocator::rebuildUsed() {
+  for (auto &u : used_) u.reset();
+  for (auto &p : device_zone_map_) {
+    for (auto &m : p.second) {
+      growDevices(m.device_idx);
+      used_[m.device_idx].set(m.zone_idx);
+    }
+  }
+  std::fill(free_hint_.begin(), free_hint_.end(), 0);
+  any_free_hint_ = 0;
+}
 void ZoneRaidAllocator::setMappingMode(idx_t logical_raid_zone_idx,
                                        RaidModeItem mode) {
   // printf("setMappingMode: set raid zone %x to mode raid%s\n",
@@ -29,37 +65,44 @@ void ZoneRaidAllocator::setMappingMode(idx_t logical_raid_zone_idx,
   setMappingMode(logical_raid_zone_idx, {mode, 0});
 }
 int ZoneRaidAllocator::getFreeDeviceZone(idx_t device) {
-  for (idx_t j = 0; j < zone_nr_; j++) {
-    auto key = std::make_pair(device, j);
-    auto f = device_zone_inv_map_.find(key);
-    if (f == device_zone_inv_map_.end()) return static_cast<int>(j);
+  growDevices(device);
+  size_t &w = free_hint_[device];
+  for (; static_cast<uint64_t>(w) * 64 < zone_nr_; w++) {
+    uint64_t free = ~takenWord(device, w);
+    if (free) return static_cast<int>(w * 64 + __builtin_ctzll(free));
   }
   return -1;
 }
 int ZoneRaidAllocator::getFreeZoneDevice(idx_t device_zone) {
+  if (device_zone >= zone_nr_) return -1;
   for (idx_t i = 0; i < device_nr_; i++) {
-    auto key = std::make_pair(i, device_zone);
-    auto f = device_zone_inv_map_.find(key);
-    if (f == device_zone_inv_map_.end()) return static_cast<int>(i);
+    if (i >= used_.size()) return static_cast<int>(i);
+    if (!used_[i].test(device_zone) && !offline_[i].test(device_zone))
+      return static_cast<int>(i);
+  }
+  return -1;
+}
+int ZoneRaidAllocator::firstFreeZone() {
+  for (; static_cast<uint64_t>(any_free_hint_) * 64 < zone_nr_;
+       any_free_hint_++) {
+    uint64_t taken = ~0ULL;
+    for (idx_t i = 0; i < device_nr_; i++)
+      taken &= takenWord(i, any_free_hint_);
+    if (~taken)
+      return static_cast<int>(any_free_hint_ * 64 + __builtin_ctzll(~taken));
   }
   return -1;
 }
 Status ZoneRaidAllocator::createMapping(idx_t logical_raid_zone_idx) {
+  // lowest free zones first, lowest device first within a zone
   size_t allocated = 0;
   while (allocated < device_nr_) {
-    bool has_allocated = false;
-    for (idx_t zone = 0; zone < zone_nr_ && allocated < device_nr_;) {
-      auto d = getFreeZoneDevice(zone);
-      if (d >= 0) {
-        addMapping(logical_raid_zone_idx * device_nr_ + allocated,
-                   static_cast<idx_t>(d), zone);
-        allocated++;
-        has_allocated = true;
-      } else {
-        zone++;
-      }
-    }
-    if (!has_allocated) break;
+    auto zone = firstFreeZone();
+    if (zone < 0) break;
+    auto d = getFreeZoneDevice(static_cast<idx_t>(zone));
+    addMapping(logical_raid_zone_idx * device_nr_ + allocated,
+               static_cast<idx_t>(d), static_cast<idx_t>(zone));
+    allocated++;
   }
   if (allocated != device_nr_)
     return Status::NoSpace();
@@ -69,27 +112,49 @@ Status ZoneRaidAllocator::createMapping(idx_t logical_raid_zone_idx) {
 Status ZoneRaidAllocator::createMappingTwice(idx_t logical_raid_zone_idx) {
   size_t allocated = 0;
   while (allocated < device_nr_ * 2) {
-    bool has_allocated = false;
-    for (idx_t zone = 0; zone < zone_nr_ && allocated < device_nr_ * 2;) {
-      auto d = getFreeZoneDevice(zone);
-      if (d >= 0) {
-        addMapping(logical_raid_zone_idx * device_nr_ + allocated / 2,
-                   static_cast<idx_t>(d), zone);
-        allocated++;
-        has_allocated = true;
-      } else {
-        zone++;
-      }
-    }
-    if (!has_allocated) break;
+    auto zone = firstFreeZone();
+    if (zone < 0) break;
+    auto d = getFreeZoneDevice(static_cast<idx_t>(zone));
+    addMapping(logical_raid_zone_idx * device_nr_ + allocated / 2,
+               static_cast<idx_t>(d), static_cast<idx_t>(zone));
+    allocated++;
   }
   if (allocated != device_nr_ * 2)
     return Status::NoSpace();
   else
     return Status::OK();
 }
+Status ZoneRaidAllocator::takeZones(
+    size_t nr_copies, std::vector<std::vector<RaidMapItem>> *subs) {
+  subs->assign(device_nr_, {});
+  // same order as createMapping, copies of a sub zone land on different
+  // devices as long as a zone index is free on several
+  for (size_t taken = 0; taken < device_nr_ * nr_copies; taken++) {
+    auto zone = firstFreeZone();
+    if (zone < 0) {
+      for (auto &sub : *subs)
+        for (auto &m : sub) removeMapping(m.device_idx, m.zone_idx);
+      subs->clear();
+      return Status::NoSpace();
+    }
+    auto d = static_cast<idx_t>(getFreeZoneDevice(static_cast<idx_t>(zone)));
+    (*subs)[taken / nr_copies].push_back(
+        RaidMapItem{d, static_cast<idx_t>(zone), 0});
+    growDevices(d);
+    used_[d].set(static_cast<idx_t>(zone));
+  }
+  return Status::OK();
+}
+size_t ZoneRaidAllocator::nrFreeZones() const {
+  size_t nr = 0;
+  for (idx_t i = 0; i < device_nr_; i++)
+    for (size_t w = 0; static_cast<uint64_t>(w) * 64 < zone_nr_; w++)
+      nr += __builtin_popcountll(~takenWord(i, w));
+  return nr;
+}
 void ZoneRaidAllocator::setOffline(idx_t device, idx_t zone) {
-  offline_zones_[std::make_pair(device, zone)] = true;
+  growDevices(device);
+  offline_[device].set(zone);
 }
 Status ZoneRaidAllocator::createOneMappingAt(idx_t logical_raid_zone_sub_idx,
                                              idx_t device, idx_t &zone) {
@@ -102,4 +167,4 @@ Status ZoneRaidAllocator::createOneMappingAt(idx_t logical_raid_zone_sub_idx,
     return Status::NoSpace();
 }
 
-}  // namespace aquafs
\ No newline at end of file
+}  // namespace aquafs
@@ -5,7 +5,10 @@
 #ifndef ROCKSDB_ZONE_RAID_ALLOCATOR_H
 #define ROCKSDB_ZONE_RAID_ALLOCATOR_H
 
-#include <map>
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
 
 #include "zone_raid.h"
 
@@ -25,25 +28,133 @@
 
 namespace aquafs {
 
+/*
+ * Map from a dense index to V, stored as a flat vector of slots: a lookup
+ * is an array access, and iteration visits the present keys in order like
+ * std::map does.
+ */
+template <typename V>
+class FlatIndexMap {
+ public:
+  using value_type = std::pair<const idx_t, V>;
+
+  template <typename M, typename P>
+  class Iter {
+   public:
+    Iter(M *map, size_t i) : map_(map), i_(i) { skip(); }
+    P &operator*() const { return map_->slots_[i_]; }
+    P *operator->() const { return &map_->slots_[i_]; }
+    Iter &operator++() {
+      i_++;
+      skip();
+      return *this;
+    }
+    Iter operator++(int) {
+      Iter it = *this;
+      ++*this;
+      return it;
+    }
+    bool operator==(const Iter &rhs) const { return i_ == rhs.i_; }
+    bool operator!=(const Iter &rhs) const { return i_ != rhs.i_; }
+
+   private:
+    M *map_;
+    size_t i_;
+    void skip() {
+      while (i_ < map_->slots_.size() && !map_->present_[i_]) i_++;
+    }
+  };
+  using iterator = Iter<FlatIndexMap, value_type>;
+  using const_iterator = Iter<const FlatIndexMap, const value_type>;
+
+  iterator begin() { return {this, 0}; }
+  iterator end() { return {this, slots_.size()}; }
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, slots_.size()}; }
+
+  [[nodiscard]] size_t size() const { return nr_present_; }
+  [[nodiscard]] bool empty() const { return nr_present_ == 0; }
+
+  iterator find(idx_t key) {
+    return contains(key) ? iterator{this, key} : end();
+  }
+  const_iterator find(idx_t key) const {
+    return contains(key) ? const_iterator{this, key} : end();
+  }
+  [[nodiscard]] bool contains(idx_t key) const {
+    return key < slots_.size() && present_[key];
+  }
+
+  V &operator[](idx_t key) {
+    grow(key);
+    if (!present_[key]) {
+      present_[key] = true;
+      nr_present_++;
+    }
+    return slots_[key].second;
+  }
+
+  /* Like std::map, an existing key is left alone */
+  void insert(const value_type &item) {
+    if (contains(item.first)) return;
+    (*this)[item.first] = item.second;
+  }
+
+  void clear() {
+    slots_.clear();
+    present_.clear();
+    nr_present_ = 0;
+  }
+
+ private:
+  std::vector<value_type> slots_;
+  std::vector<bool> present_;
+  size_t nr_present_ = 0;
+
+  void grow(idx_t key) {
+    if (key < slots_.size()) return;
+    slots_.reserve(std::max<size_t>(key + 1, slots_.size() * 2));
+    while (slots_.size() <= key) slots_.emplace_back(slots_.size(), V{});
+    present_.resize(slots_.size(), false);
+  }
+};
+
+/* One bit per zone of a device, scanned a 64-bit word at a time */
+class ZoneBitmap {
+ public:
+  void set(idx_t zone) {
+    grow(zone);
+    words_[zone / 64] |= 1ULL << (zone % 64);
+  }
+  void clear(idx_t zone) {
+    if (zone / 64 < words_.size()) words_[zone / 64] &= ~(1ULL << (zone % 64));
+  }
+  [[nodiscard]] bool test(idx_t zone) const {
+    return zone / 64 < words_.size() && (words_[zone / 64] >> (zone % 64)) & 1;
+  }
+  /* Word w of the bitmap, zones past the end read as clear */
+  [[nodiscard]] uint64_t word(size_t w) const {
+    return w < words_.size() ? words_[w] : 0;
+  }
+  void reset() { words_.clear(); }
+
+ private:
+  std::vector<uint64_t> words_;
+
+  void grow(idx_t zone) {
+    if (zone / 64 >= words_.size()) words_.resize(zone / 64 + 1, 0);
+  }
+};
+
 class ZoneRaidAllocator {
  public:
-  // use `map` or `unordered_map` to store raid mappings
-  template <typename K, typename V>
-  using map_use = std::map<K, V>;
-  using device_zone_map_t = map_use<idx_t, std::vector<RaidMapItem>>;
-  using mode_map_t = map_use<idx_t, RaidModeItem>;
-  // <device idx, zone idx> -> raid zone idx, unsupported: unordered_map
-  using device_zone_t = std::pair<idx_t, idx_t>;
-  using device_zone_inv_map_t = map_use<device_zone_t, idx_t>;
+  using device_zone_map_t = FlatIndexMap<std::vector<RaidMapItem>>;
+  using mode_map_t = FlatIndexMap<RaidModeItem>;
 
   // map: raid zone idx (* sz) -> vec<device idx, device zone idx>
   device_zone_map_t device_zone_map_{};
-  // map: <device idx, device zone idx> -> raid zone idx (* sz)
-  device_zone_inv_map_t device_zone_inv_map_{};
   // map: raid zone idx -> raid mode, option
   mode_map_t mode_map_{};
-  // offline zones
-  map_use<device_zone_t, bool> offline_zones_;
 
   idx_t device_nr_{};
   idx_t zone_nr_{};
@@ -58,6 +169,10 @@ class ZoneRaidAllocator {
 
   Status addMapping(idx_t logical_raid_zone_sub_idx, idx_t physical_device_idx,
                     idx_t physical_zone_idx);
+  /* Gives a device zone back, once no raid zone maps to it any more */
+  void removeMapping(idx_t physical_device_idx, idx_t physical_zone_idx);
+  /* Marks the zones of device_zone_map_ as taken, after it was replaced */
+  void rebuildUsed();
   void setMappingMode(idx_t logical_raid_zone_idx, RaidModeItem mode);
   void setMappingMode(idx_t logical_raid_zone_idx, RaidMode mode);
 
@@ -67,7 +182,36 @@ class ZoneRaidAllocator {
   Status createMappingTwice(idx_t logical_raid_zone_idx);
   Status createOneMappingAt(idx_t logical_raid_zone_sub_idx, idx_t device,
                             idx_t &zone);
+  /* Takes nr_copies free zones for each of the device_nr_ sub zones of a
+   * raid zone without mapping them, all or nothing */
+  Status takeZones(size_t nr_copies,
+                   std::vector<std::vector<RaidMapItem>> *subs);
+  /* Offline zones are never handed out again. Allocation used to skip only
+   * mapped zones, so on devices with offline zones the layouts differ from
+   * those of older versions for the same sequence of calls. */
   void setOffline(idx_t device, idx_t zone);
+  [[nodiscard]] bool isOffline(idx_t device, idx_t zone) const {
+    return device < offline_.size() && offline_[device].test(zone);
+  }
+  [[nodiscard]] bool isUsed(idx_t device, idx_t zone) const {
+    return device < used_.size() && used_[device].test(zone);
+  }
+  [[nodiscard]] size_t nrFreeZones() const;
+
+ private:
+  // per device: zones mapped to a raid zone, and zones gone offline
+  std::vector<ZoneBitmap> used_;
+  std::vector<ZoneBitmap> offline_;
+  // no device has a free zone in words below these, per device and for
+  // any device
+  std::vector<size_t> free_hint_;
+  size_t any_free_hint_ = 0;
+
+  void growDevices(idx_t device);
+  // taken zones of device in word w, zones past zone_nr_ count as taken
+  [[nodiscard]] uint64_t takenWord(idx_t device, size_t w) const;
+  // first zone which is free on any of the devices, -1 if none
+  int firstFreeZone();
 };
 
 }  // namespace aquafs
@@ -6,20 +6,33 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <memory>
 #include <numeric>
 #include <queue>
 #include <utility>
 
-#ifdef AQUAFS_RAID_URING
-#include "../../liburing4cpp/include/liburing/io_service.hpp"
-#endif
 #include "../aquafs_utils.h"
 #include "../zbdlib_aquafs.h"
 #include "rocksdb/io_status.h"
 #include "../../base/coding.h"
 
 DEFINE_string(raid_auto_default, "1", "Default RAID mode for auto-raid");
+DEFINE_bool(raid_auto_convert, false,
+            "Convert full RAID-A zones between RAID1 and striped layouts by "
+            "their read heat");
+DEFINE_uint64(raid_auto_convert_interval, 60 * 1000,
+              "Milliseconds between RAID-A conversion passes, zone heat "
+              "halves every pass");
+DEFINE_string(raid_auto_cold_mode, "0",
+              "Layout cold RAID1 zones are converted to: 0 or c");
+DEFINE_uint64(raid_auto_hot_read, 256,
+              "Read heat in MB which promotes a RAID-A zone to RAID1");
+DEFINE_uint64(raid_auto_cold_read, 1,
+              "Read and write heat in MB under which a RAID1 zone is demoted");
+DEFINE_uint32(raid_auto_convert_max, 2, "Most RAID-A zones converted per pass");
+DEFINE_uint32(raid_auto_free_reserve, 10,
+              "Percent of device zones left free by promotions to RAID1");
 
 namespace aquafs {
 
@@ -40,6 +53,7 @@ RaidAutoZonedBlockDevice::RaidAutoZonedBlockDevice(
       allocator.addMapping(idx * nr_dev() + i, 0, idx * nr_dev() + i);
     allocator.setMappingMode(idx, RaidMode::RAID_NONE);
   }
+  publish_layout();
   syncBackendInfo();
 }
 
@@ -50,14 +64,19 @@ IOStatus RaidAutoZonedBlockDevice::Open(bool readonly, bool exclusive,
                                               max_active_zones, max_open_zones);
   if (!s.ok()) return s;
   allocator.setInfo(nr_dev(), nr_zones_);
+  if (!refresh_dev_zones())
+    return IOStatus::IOError("RAID-A: failed to list device zones");
   // scan offline zones
-  for (idx_t d = 0; d < nr_dev(); d++)
-    for (idx_t z = 0; z < nr_zones_; z++) {
-      auto zones = devices_[d]->ListZones();
-      if (devices_[d]->ZoneIsOffline(zones, z)) {
-        allocator.setOffline(d, z);
+  {
+    std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+    for (idx_t d = 0; d < nr_dev(); d++)
+      for (idx_t z = 0; z < nr_zones_; z++) {
+        if (devices_[d]->ZoneIsOffline(dev_zones_[d], z)) {
+          allocator.setOffline(d, z);
+        }
       }
-    }
+  }
+  heat_ = std::make_unique<ZoneHeatCounter[]>(nr_zones_);
   // allocate default layout
   a_zones_.reset(new raid_zone_t[nr_zones_]);
   memset(a_zones_.get(), 0, sizeof(raid_zone_t) * nr_zones_);
@@ -85,10 +104,67 @@ IOStatus RaidAutoZonedBlockDevice::Open(bool readonly, bool exclusive,
   } else {
     assert(false);
   }
+  publish_layout();
   flush_zone_info();
   return s;
 }
 
+bool RaidAutoZonedBlockDevice::refresh_dev_zones() {
+  bool ok = true;
+  for (idx_t d = 0; d < nr_dev(); d++) ok = refresh_dev_zones(d) && ok;
+  return ok;
+}
+
+bool RaidAutoZonedBlockDevice::refresh_dev_zones(idx_t device_idx) {
+  auto zones = devices_[device_idx]->ListZones();
+  if (!zones) {
+    // keep the last report, it is only off by what failed to update
+    Error(logger_, "RAID-A: cannot list zones of device %x", device_idx);
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  if (dev_zones_.size() != nr_dev()) dev_zones_.resize(nr_dev());
+  dev_zones_[device_idx] = std::move(zones);
+  return true;
+}
+
+void RaidAutoZonedBlockDevice::dev_zone_reset(idx_t device_idx, idx_t zone_idx,
+                                              bool offline,
+                                              uint64_t max_capacity) {
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  auto z = dev_zone(device_idx, zone_idx);
+  z->wp = z->start;
+  z->capacity = offline ? 0 : max_capacity;
+  z->cond = offline ? ZBD_ZONE_COND_OFFLINE : ZBD_ZONE_COND_EMPTY;
+}
+
+void RaidAutoZonedBlockDevice::dev_zone_finish(idx_t device_idx,
+                                               idx_t zone_idx) {
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  auto z = dev_zone(device_idx, zone_idx);
+  z->wp = z->start + z->len;
+  z->cond = ZBD_ZONE_COND_FULL;
+}
+
+void RaidAutoZonedBlockDevice::dev_zone_close(idx_t device_idx,
+                                              idx_t zone_idx) {
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  auto z = dev_zone(device_idx, zone_idx);
+  if (z->cond == ZBD_ZONE_COND_IMP_OPEN || z->cond == ZBD_ZONE_COND_EXP_OPEN)
+    z->cond = z->wp == z->start ? ZBD_ZONE_COND_EMPTY : ZBD_ZONE_COND_CLOSED;
+}
+
+void RaidAutoZonedBlockDevice::dev_zone_written(idx_t device_idx, uint64_t pos,
+                                                uint64_t size) {
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  auto z = dev_zone(device_idx, pos / def_dev()->GetZoneSize());
+  z->wp = std::max<uint64_t>(z->wp, pos + size);
+  if (z->wp >= z->start + z->capacity)
+    z->cond = ZBD_ZONE_COND_FULL;
+  else if (z->cond != ZBD_ZONE_COND_EXP_OPEN)
+    z->cond = ZBD_ZONE_COND_IMP_OPEN;
+}
+
 void RaidAutoZonedBlockDevice::syncBackendInfo() {
   AbstractRaidZonedBlockDevice::syncBackendInfo();
   zone_sz_ *= nr_dev();
@@ -118,8 +194,8 @@ IOStatus RaidAutoZonedBlockDevice::Reset(uint64_t start, bool *offline,
            m.zone_idx);
       if (!r.ok())
         return r;
-      else
-        *max_capacity *= nr_dev();
+      dev_zone_reset(m.device_idx, m.zone_idx, *offline, *max_capacity);
+      *max_capacity *= nr_dev();
     }
   }
   flush_zone_info();
@@ -139,6 +215,7 @@ IOStatus RaidAutoZonedBlockDevice::Finish(uint64_t start) {
       Info(logger_, "RAID-A: do finish for device %d, zone %d", m.device_idx,
            m.zone_idx);
       if (!r.ok()) return r;
+      dev_zone_finish(m.device_idx, m.zone_idx);
     }
   }
   // flush_zone_info();
@@ -182,6 +259,7 @@ IOStatus RaidAutoZonedBlockDevice::Close(uint64_t start) {
       } else {
         Info(logger_, "RAID-A: do close for device %d, zone %d", m.device_idx,
              m.zone_idx);
+        dev_zone_close(m.device_idx, m.zone_idx);
       }
     }
   }
@@ -216,12 +294,14 @@ int RaidAutoZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
     return sz_read;
   } else {
     assert(static_cast<decltype(zone_sz_)>(size) <= zone_sz_);
-    auto mode_item = allocator.mode_map_[pos / zone_sz_];
-    if (mode_item.mode == RaidMode::RAID_C ||
-        // mode_item.mode == RaidMode::RAID1 ||
-        mode_item.mode == RaidMode::RAID_NONE) {
-      auto m = getAutoDeviceZone(pos);
-      auto mapped_pos = getAutoMappedDevicePos(pos);
+    if (heat_) heat_[pos / zone_sz_].read += size;
+    auto table = layout();
+    auto mode = table->mode(pos / zone_sz_);
+    if (mode == RaidMode::RAID_C ||
+        // mode == RaidMode::RAID1 ||
+        mode == RaidMode::RAID_NONE) {
+      uint64_t mapped_pos;
+      auto m = translate(*table, pos, &mapped_pos);
       auto r = devices_[m.device_idx]->Read(buf, size, mapped_pos, direct);
       // Info(logger_,
       //      "RAID-A: READ raid%s mapping pos=%lx to mapped_pos=%lx, dev=%x,"
@@ -236,24 +316,18 @@ int RaidAutoZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
       //   printf("\n");
       // }
       return r;
-    } else if (mode_item.mode == RaidMode::RAID1) {
-      idx_t raid_zone_idx = pos / zone_sz_;
-      // auto raid_zone_offset = pos - raid_zone_idx * zone_sz_;
-      idx_t inner_zone_idx_offset = (pos / def_dev()->GetZoneSize()) % nr_dev();
+    } else if (mode == RaidMode::RAID1) {
       auto inner_zone_offset = pos % def_dev()->GetZoneSize();
-      auto &m = allocator.device_zone_map_[raid_zone_idx * nr_dev() +
-                                           inner_zone_idx_offset];
+      auto &m = table->sub_zone(translate_sub_idx(*table, pos));
       assert(size <= static_cast<decltype(size)>(def_dev()->GetZoneSize()));
-      int r = -1;
-      for (auto &mm : m) {
-        // TODO: spare read to all devices
-        r = devices_[mm.device_idx]->Read(
-            buf, size,
-            mm.zone_idx * def_dev()->GetZoneSize() + inner_zone_offset, direct);
-        // FIXME
-        // if (r < 0)
-        break;
+      std::vector<RaidMirror> mirrors;
+      for (uint32_t i = 0; i < m.nr_mirrors; i++) {
+        auto mm = m.mirror(i);
+        mirrors.push_back(
+            {mm.device_idx,
+             mm.zone_idx * def_dev()->GetZoneSize() + inner_zone_offset});
       }
+      int r = ReadMirrored(std::move(mirrors), buf, size, direct);
       if (r < 0) {
         auto status = ScanAndHandleOffline();
         if (status.ok()) {
@@ -265,89 +339,23 @@ int RaidAutoZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
         }
       }
       return r;
-    } else if (mode_item.mode == RaidMode::RAID0) {
-#ifndef AQUAFS_RAID_URING
-      RaidMapItem m;
-      uint64_t mapped_pos;
-      // split read range as blocks
-      int sz_read = 0;
-      // TODO: Read blocks in multi-threads
-      int r;
+    } else if (mode == RaidMode::RAID0) {
+      // split read range as blocks, issued to all devices at once
+      std::vector<RaidStripeUnit> units;
       while (size > 0) {
-        m = getAutoDeviceZone(pos);
-        mapped_pos = getAutoMappedDevicePos(pos);
+        uint64_t mapped_pos;
+        auto m = translate(*table, pos, &mapped_pos);
         auto req_size = std::min(
             size,
             static_cast<int>(GetBlockSize() - mapped_pos % GetBlockSize()));
-        r = devices_[m.device_idx]->Read(buf, req_size, mapped_pos, direct);
-        // Info(
-        //     logger_,
-        //     "RAID-A: [read=%x] READ raid0 mapping pos=%lx to
-        //     mapped_pos=%lx, " "dev=%x, zone=%x; r=%x", sz_read, pos,
-        //     mapped_pos, m.device_idx, m.zone_idx, r);
-        if (r > 0) {
-          size -= r;
-          sz_read += r;
-          buf += r;
-          pos += r;
-        } else {
-          return r;
-        }
-      }
-      // flush_zone_info();
-      return sz_read;
-#else
-      uio::io_service service;
-      RaidMapItem m;
-      uint64_t mapped_pos;
-      // split read range as blocks
-      int sz_read = 0;
-      using req_item_t = std::tuple<int, char *, uint64_t, off_t>;
-      std::vector<req_item_t> requests;
-      std::vector<ZbdlibBackend *> bes(nr_dev());
-      for (decltype(nr_dev()) i = 0; i < nr_dev(); i++) {
-#ifdef ROCKSDB_USE_RTTI
-        bes[i] = dynamic_cast<ZbdlibBackend *>(devices_[i].get());
-        assert(bes[i] != nullptr);
-#else
-        bes[i] = (ZbdlibBackend *)(devices_[i].get());
-#endif
-      }
-      while (size > 0) {
-        m = getAutoDeviceZone(pos);
-        mapped_pos = getAutoMappedDevicePos(pos);
-        auto req_size = std::min(
-            size,
-            static_cast<int>(GetBlockSize() - mapped_pos % GetBlockSize()));
-        if (req_size == 0) break;
-        auto be = bes[m.device_idx];
-        assert(be != nullptr);
-        int fd = direct ? be->read_direct_f_ : be->read_f_;
-        requests.emplace_back(fd, buf, req_size, mapped_pos);
+        units.push_back({m.device_idx, buf, static_cast<uint32_t>(req_size),
+                         mapped_pos});
         size -= req_size;
-        sz_read += req_size;
         buf += req_size;
         pos += req_size;
       }
-      service.run([&]() -> uio::task<> {
-        std::vector<uio::task<int>> futures;
-        for (auto &&req : requests) {
-          uint8_t flags = 0;
-          // read do not need order
-          // if (req != *req_list.second.cend()) flags |= IOSQE_IO_LINK;
-          futures.emplace_back(service.read(std::get<0>(req), std::get<1>(req),
-                                            std::get<2>(req), std::get<3>(req),
-                                            flags) |
-                               uio::panic_on_err("failed to read!", true));
-        }
-        for (auto &&fut : futures) co_await fut;
-      }());
       // flush_zone_info();
-#ifdef AQUAFS_SIM_DELAY
-      delay_us(calculate_delay_us(size / requests.size()));
-#endif
-      return sz_read;
-#endif
+      return SubmitStriped(units, false, direct);
     } else {
       assert(false);
     }
@@ -382,169 +390,83 @@ int RaidAutoZonedBlockDevice::Write(char *data, uint32_t size, uint64_t pos) {
     return sz_written;
   } else {
     assert(static_cast<decltype(dev_zone_sz)>(size) <= dev_zone_sz);
-    auto mode_item = allocator.mode_map_[pos / zone_sz_];
-    if (mode_item.mode == RaidMode::RAID_C ||
-        mode_item.mode == RaidMode::RAID_NONE) {
-      auto m = getAutoDeviceZone(pos);
-      auto mapped_pos = getAutoMappedDevicePos(pos);
+    if (heat_) heat_[pos / zone_sz_].write += size;
+    auto table = layout();
+    auto mode = table->mode(pos / zone_sz_);
+    if (mode == RaidMode::RAID_C || mode == RaidMode::RAID_NONE) {
+      uint64_t mapped_pos;
+      auto m = translate(*table, pos, &mapped_pos);
       auto r = devices_[m.device_idx]->Write(data, size, mapped_pos);
+      if (r > 0)
+        dev_zone_written(m.device_idx, mapped_pos, r);
+      else
+        refresh_dev_zones(m.device_idx);
       // Info(logger_,
       //      "RAID-A: WRITE raid%s mapping pos=%lx to mapped_pos=%lx, size=%x,
       //      " "dev=%x, zone=%x; r=%x", raid_mode_str(mode_item.mode), pos,
       //      mapped_pos, size, m.device_idx, m.zone_idx, r);
       return r;
-    } else if (mode_item.mode == RaidMode::RAID1) {
-      // raid_zone_idx: 哪一个 RaidZone = 偏移量 / RaidZone 大小
-      idx_t raid_zone_idx = pos / zone_sz_;
-      // inner_zone_idx: 哪一个 Device Zone = 偏移量 / Device Zone 大小
-      idx_t inner_zone_idx = pos / def_dev()->GetZoneSize();
-      // inner_zone_idx_offset: 在 RaidZone 中是第几个 Device Zone
-      idx_t inner_zone_idx_offset = inner_zone_idx % nr_dev();
+    } else if (mode == RaidMode::RAID1) {
       // 在 RaidZone 内的偏移量
       auto inner_zone_offset = pos % def_dev()->GetZoneSize();
-      // Raid Zone Sub Index: 在 Device Zone Map 中的索引，这个索引值 / 设备数 = RaidZone Index
       // Raid Zone Sub Index = (RaidZone Index * 设备数量) + (在 RaidZone 中是第几个 Device Zone)
-      auto sub_idx = raid_zone_idx * nr_dev() + inner_zone_idx_offset;
+      auto sub_idx = translate_sub_idx(*table, pos);
       // 用 Raid Zone Sub Index 查找映射信息
-      auto fm = allocator.device_zone_map_.find(sub_idx);
-      if (fm == allocator.device_zone_map_.end()) {
+      auto &m = table->sub_zone(sub_idx);
+      if (m.nr_mirrors == 0) {
         Error(logger_,
-              "Cannot locate raid1 write: sub idx %zx not in device zone map",
+              "Cannot locate raid1 write: sub idx %x not in device zone map",
               sub_idx);
+        return -1;
       }
-      auto m = fm->second;
       assert(size <= static_cast<decltype(size)>(def_dev()->GetZoneSize()));
-      // write to all mapped zones
-      int r;
-      // std::string mp_info = "[mp] raid zone " + std::to_string(sub_idx) + ":
-      // "; for (auto &mm : m)
-      //   mp_info += "dev " + std::to_string(mm.device_idx) + ", zone " +
-      //              std::to_string(mm.zone_idx) + "; ";
-      for (auto mm : m) {
-        r = devices_[mm.device_idx]->Write(
-            data, size,
-            mm.zone_idx * def_dev()->GetZoneSize() + inner_zone_offset);
-        // Info(logger_,
-        //      "writing raid1: pos=%lx, size=%x, backend dev=%x, zone=%x, r=%x,
-        //      " "mp: %s", pos, size, mm.device_idx, mm.zone_idx, r,
-        //      mp_info.c_str());
-        if (r < 0) {
-          Error(logger_,
-                "Cannot write raid1! r=%d, pos=%lx, size=%x, backend dev=%x, "
-                "zone=%x, writing dev pos %lx",
-                r, pos, size, mm.device_idx, mm.zone_idx,
-                mm.zone_idx * def_dev()->GetZoneSize() + inner_zone_offset);
-          return r;
-        }
+      // write to all mapped zones at once
+      std::vector<RaidMirror> mirrors;
+      for (uint32_t i = 0; i < m.nr_mirrors; i++) {
+        auto mm = m.mirror(i);
+        mirrors.push_back(
+            {mm.device_idx,
+             mm.zone_idx * def_dev()->GetZoneSize() + inner_zone_offset});
       }
-      return r;
-    } else if (mode_item.mode == RaidMode::RAID0) {
-#ifndef AQUAFS_RAID_URING
-      RaidMapItem m;
-      uint64_t mapped_pos;
-      // split write range as blocks
-      int sz_written = 0;
-      // TODO: Write blocks in multi-threads
-      int r;
-      while (size > 0) {
-        m = getAutoDeviceZone(pos);
-        mapped_pos = getAutoMappedDevicePos(pos);
-        // auto z = devices_[m.device_idx]->ListZones();
-        // auto p = reinterpret_cast<raid_zone_t *>(z->GetData());
-        // auto pp = p[m.zone_idx];
-        // if ((pos == 0x20000000 || mapped_pos == 0x8000000) &&
-        //     (m.device_idx == 0 && m.zone_idx == 4)) {
-        //   mapped_pos = getAutoMappedDevicePos(pos);
-        //   Info(logger_,
-        //        "[DBG] RAID-A-0: dev_zone_info: st=%llx, cap=%llx, "
-        //        "wp=%llx, sz=%llx; to write: dev=%x, zone=%x, pos=%lx,sz=%x",
-        //        pp.start, pp.capacity, pp.wp, pp.capacity, m.device_idx,
-        //        m.zone_idx, mapped_pos, size);
-        // }
-        auto req_size =
-            std::min(size, static_cast<uint32_t>(GetBlockSize() -
-                                                 mapped_pos % GetBlockSize()));
-        r = devices_[m.device_idx]->Write(data, req_size, mapped_pos);
-        // Info(logger_,
-        //      "RAID-A: [written=%x] WRITE raid0 mapping pos=%lx to "
-        //      "mapped_pos=%lx, "
-        //      "dev=%x, zone=%x; r=%x",
-        //      sz_written, pos, mapped_pos, m.device_idx, m.zone_idx, r);
-        if (r > 0) {
-          size -= r;
-          sz_written += r;
-          data += r;
-          pos += r;
-        } else {
-          return r;
-        }
-      }
-      // flush_zone_info();
-      zone_info(pos_raw / zone_sz_)->wp += size;
-      return sz_written;
-#else
-      uio::io_service service;
-      RaidMapItem m;
-      uint64_t mapped_pos;
-      uint32_t sz_written = 0;
-      using req_item_t = std::tuple<char *, uint64_t, off_t>;
-      // <dev, zone> -> vec<ordered req>
-      std::map<std::pair<int, idx_t>, std::vector<req_item_t>> requests;
-      std::vector<ZbdlibBackend *> bes(nr_dev());
-      for (decltype(nr_dev()) i = 0; i < nr_dev(); i++) {
-#ifdef ROCKSDB_USE_RTTI
-        bes[i] = dynamic_cast<ZbdlibBackend *>(devices_[i].get());
-        assert(bes[i] != nullptr);
-#else
-        bes[i] = (ZbdlibBackend *)(devices_[i].get());
-#endif
+      int r = WriteMirrored(mirrors, data, size);
+      if (r < 0) {
+        Error(logger_, "Cannot write raid1! pos=%lx, size=%x, sub idx %x",
+              pos, size, sub_idx);
+        // some mirrors may have taken the data, read back where they are
+        for (auto &mirror : mirrors) refresh_dev_zones(mirror.device_idx);
+        return r;
       }
+      for (auto &mirror : mirrors)
+        dev_zone_written(mirror.device_idx, mirror.pos, size);
+      return r;
+    } else if (mode == RaidMode::RAID0) {
+      // split write range as blocks, issued to all devices at once
+      std::vector<RaidStripeUnit> units;
       while (size > 0) {
-        m = getAutoDeviceZone(pos);
-        mapped_pos = getAutoMappedDevicePos(pos);
+        uint64_t mapped_pos;
+        auto m = translate(*table, pos, &mapped_pos);
         auto req_size =
             std::min(size, static_cast<uint32_t>(GetBlockSize() -
                                                  mapped_pos % GetBlockSize()));
-        auto dev_zone_idx = mapped_pos / def_dev()->GetZoneSize();
-        if (req_size == 0) break;
-        auto be = bes[m.device_idx];
-        assert(be != nullptr);
-        int fd = be->write_f_;
-        requests[{fd, dev_zone_idx}].emplace_back(data, req_size, mapped_pos);
+        units.push_back({m.device_idx, data, req_size, mapped_pos});
         size -= req_size;
-        sz_written += req_size;
         data += req_size;
         pos += req_size;
       }
-      service.run([&]() -> uio::task<> {
-        // std::vector<uio::task<int>> futures;
-        std::vector<uio::sqe_awaitable> futures;
-        for (const auto &req_list : requests) {
-          for (auto &&req : req_list.second) {
-            uint8_t flags = 0;
-            if (req != *req_list.second.cend()) flags |= IOSQE_IO_LINK;
-            futures.emplace_back(
-                service.write(req_list.first.first, std::get<0>(req),
-                              std::get<1>(req), std::get<2>(req), flags));
-            // pwrite(req_list.first.first, std::get<0>(req), std::get<1>(req),
-            //        std::get<2>(req));
-          }
-        }
-        // for (auto &&fut : futures) {
-        //   // delay_us(0);
-        //   // co_await fut | uio::panic_on_err("failed to write!", true);
-        //   // co_await fut;
-        //   break;
-        // }
-        co_return;
-      }());
-#ifdef AQUAFS_SIM_DELAY
-      delay_us(calculate_delay_us(size / requests.size()));
-#endif
+      auto r = SubmitStriped(units, true, false);
+      if (r < 0) {
+        // some units may have been written, read back where the devices are
+        std::vector<bool> involved(nr_dev());
+        for (auto &unit : units) involved[unit.device_idx] = true;
+        for (idx_t d = 0; d < nr_dev(); d++)
+          if (involved[d]) refresh_dev_zones(d);
+        return r;
+      }
+      for (auto &unit : units)
+        dev_zone_written(unit.device_idx, unit.pos, unit.size);
       // flush_zone_info();
-      zone_info(pos_raw / zone_sz_)->wp += size_raw;
-      return static_cast<int>(sz_written);
-#endif
+      zone_info(pos_raw / zone_sz_)->wp += r;
+      return r;
     }
   }
   return -1;
@@ -583,40 +505,40 @@ bool RaidAutoZonedBlockDevice::ZoneIsSwr(std::unique_ptr<ZoneList> &zones,
                                          idx_t idx) {
   // Info(logger_, "ZoneIsSwr(idx=%x)", idx);
   auto m = getAutoDeviceZoneFromIdx(idx);
-  auto z = devices_[m.device_idx]->ListZones();
-  return devices_[m.device_idx]->ZoneIsSwr(z, m.zone_idx);
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  return devices_[m.device_idx]->ZoneIsSwr(dev_zones_[m.device_idx], m.zone_idx);
 }
 
 bool RaidAutoZonedBlockDevice::ZoneIsOffline(std::unique_ptr<ZoneList> &zones,
                                              idx_t idx) {
   // Info(logger_, "ZoneIsOffline(idx=%x)", idx);
   auto m = getAutoDeviceZoneFromIdx(idx);
-  auto z = devices_[m.device_idx]->ListZones();
-  return devices_[m.device_idx]->ZoneIsOffline(z, m.zone_idx);
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  return devices_[m.device_idx]->ZoneIsOffline(dev_zones_[m.device_idx], m.zone_idx);
 }
 
 bool RaidAutoZonedBlockDevice::ZoneIsWritable(std::unique_ptr<ZoneList> &zones,
                                               idx_t idx) {
   // Debug(logger_, "ZoneIsWriteable(idx=%x)", idx);
   auto m = getAutoDeviceZoneFromIdx(idx);
-  auto z = devices_[m.device_idx]->ListZones();
-  return devices_[m.device_idx]->ZoneIsWritable(z, m.zone_idx);
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  return devices_[m.device_idx]->ZoneIsWritable(dev_zones_[m.device_idx], m.zone_idx);
 }
 
 bool RaidAutoZonedBlockDevice::ZoneIsActive(std::unique_ptr<ZoneList> &zones,
                                             idx_t idx) {
   // Info(logger_, "ZoneIsActive(idx=%x)", idx);
   auto m = getAutoDeviceZoneFromIdx(idx);
-  auto z = devices_[m.device_idx]->ListZones();
-  return devices_[m.device_idx]->ZoneIsActive(z, m.zone_idx);
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  return devices_[m.device_idx]->ZoneIsActive(dev_zones_[m.device_idx], m.zone_idx);
 }
 
 bool RaidAutoZonedBlockDevice::ZoneIsOpen(std::unique_ptr<ZoneList> &zones,
                                           idx_t idx) {
   // Info(logger_, "ZoneIsOpen(idx=%x)", idx);
   auto m = getAutoDeviceZoneFromIdx(idx);
-  auto z = devices_[m.device_idx]->ListZones();
-  return devices_[m.device_idx]->ZoneIsOpen(z, m.zone_idx);
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  return devices_[m.device_idx]->ZoneIsOpen(dev_zones_[m.device_idx], m.zone_idx);
 }
 
 uint64_t RaidAutoZonedBlockDevice::ZoneStart(std::unique_ptr<ZoneList> &zones,
@@ -645,19 +567,16 @@ uint64_t RaidAutoZonedBlockDevice::ZoneWp(std::unique_ptr<ZoneList> &zones,
 }
 
 void RaidAutoZonedBlockDevice::flush_zone_info() {
-  // TODO
-  // std::vector<std::unique_ptr<ZoneList>> dev_zone_list(nr_dev());
-  // for (idx_t idx = 0; idx < nr_dev(); idx++) {
-  //   auto z = devices_[idx]->ListZones();
-  //   dev_zone_list[idx] = std::move(z);
-  // }
+  std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+  // nothing to derive from before the devices are open
+  if (dev_zones_.size() != nr_dev() || !a_zones_) return;
   for (idx_t idx = 0; idx < nr_zones_; idx++) {
     auto found_mode_map = allocator.mode_map_.find(idx);
     if (found_mode_map == allocator.mode_map_.end()) continue;
     auto mode_item = found_mode_map->second;
     // Debug(logger_, "flush_zone_info: zone %x is raid%s", idx,
     //      raid_mode_str(mode_item.mode));
-    std::unique_ptr<ZoneList> zone_list = nullptr;
+    raid_zone_t *zone_list_ptr = nullptr;
     auto p = a_zones_.get();
     p[idx].start = idx * zone_sz_;
     if (mode_item.mode == RaidMode::RAID_NONE ||
@@ -668,13 +587,13 @@ void RaidAutoZonedBlockDevice::flush_zone_info() {
         map_items[i] =
             getAutoDeviceZone(idx * zone_sz_ + i * def_dev()->GetZoneSize());
       auto map_item = map_items.front();
-      zone_list = devices_[map_item.device_idx]->ListZones();
+      zone_list_ptr = dev_zone(map_item.device_idx, map_item.zone_idx);
       uint64_t wp = std::accumulate(
           map_items.begin(), map_items.end(), static_cast<uint64_t>(0),
           [&](uint64_t sum, auto &item) {
-            auto z = devices_[item.device_idx]->ListZones();
-            auto s = devices_[item.device_idx]->ZoneStart(z, item.zone_idx);
-            auto w = devices_[item.device_idx]->ZoneWp(z, item.zone_idx);
+            auto z = dev_zone(item.device_idx, item.zone_idx);
+            uint64_t s = z->start;
+            uint64_t w = z->wp;
             // printf("\tdev[%x][%x] st=%lx, wp=%lx\n", item.device_idx,
             //        item.zone_idx, s, w);
             assert(w >= s);
@@ -696,9 +615,8 @@ void RaidAutoZonedBlockDevice::flush_zone_info() {
         }
         auto m = fm->second;
         auto mm = m[0];
-        zone_list = devices_[mm.device_idx]->ListZones();
-        auto c = devices_[mm.device_idx]->ZoneWp(zone_list, mm.zone_idx) -
-                 devices_[mm.device_idx]->ZoneStart(zone_list, mm.zone_idx);
+        zone_list_ptr = dev_zone(mm.device_idx, mm.zone_idx);
+        auto c = zone_list_ptr->wp - zone_list_ptr->start;
         // if (c > 0) {
         //   Info(logger_, "adding size %lx in dev %x zone %x to raid zone %x",
         //   c,
@@ -708,13 +626,14 @@ void RaidAutoZonedBlockDevice::flush_zone_info() {
       }
       p[idx].wp = p[idx].start + cnt;
     }
-    raid_zone_t *zone_list_ptr =
-        reinterpret_cast<raid_zone_t *>(zone_list->GetData());
     // FIXME: ZoneFS
-    p[idx].flags = zone_list_ptr->flags;
-    p[idx].type = zone_list_ptr->type;
-    p[idx].cond = zone_list_ptr->cond;
-    memcpy(p[idx].reserved, zone_list_ptr->reserved, sizeof(p[idx].reserved));
+    if (zone_list_ptr != nullptr) {
+      p[idx].flags = zone_list_ptr->flags;
+      p[idx].type = zone_list_ptr->type;
+      p[idx].cond = zone_list_ptr->cond;
+      memcpy(p[idx].reserved, zone_list_ptr->reserved,
+             sizeof(p[idx].reserved));
+    }
     // p[idx].capacity = devices_[map_item.device_idx]->ZoneMaxCapacity(
     //                       zone_list, map_item.zone_idx) *
     //                   nr_dev();
@@ -727,23 +646,42 @@ void RaidAutoZonedBlockDevice::layout_update(
     RaidAutoZonedBlockDevice::mode_map_t &&mode_map) {
   Warn(logger_, "layout_update! device_zone %zu items, mode_map %zu items",
        device_zone.size(), mode_map.size());
-  for (auto &&p : device_zone) allocator.device_zone_map_.insert(p);
-  for (auto &&p : mode_map) allocator.mode_map_.insert(p);
+  std::lock_guard<std::mutex> lock(layout_mtx_);
+  // a record holds the whole layout of the raid zones in its mode map,
+  // which replaces theirs
+  for (auto &&p : device_zone) {
+    if (mode_map.contains(p.first / nr_dev()))
+      allocator.device_zone_map_[p.first] = p.second;
+    else
+      allocator.device_zone_map_.insert(p);
+  }
+  for (auto &&p : mode_map) allocator.setMappingMode(p.first, p.second);
+  layout_diverged_ = layout_diverged_ || mode_map.size() > 0;
+  allocator.rebuildUsed();
+  publish_layout();
   flush_zone_info();
 }
 void RaidAutoZonedBlockDevice::layout_setup(
     RaidAutoZonedBlockDevice::device_zone_map_t &&device_zone,
     RaidAutoZonedBlockDevice::mode_map_t &&mode_map) {
+  std::lock_guard<std::mutex> lock(layout_mtx_);
   allocator.device_zone_map_ = std::move(device_zone);
   allocator.mode_map_ = std::move(mode_map);
+  allocator.rebuildUsed();
+  publish_layout();
   flush_zone_info();
 }
+void RaidAutoZonedBlockDevice::publish_layout() {
+  std::shared_ptr<const RaidTranslationTable> table =
+      std::make_shared<RaidTranslationTable>(allocator, nr_dev());
+  std::atomic_store(&layout_, std::move(table));
+}
 template <class T>
 RaidMapItem RaidAutoZonedBlockDevice::getAutoDeviceZoneFromIdx(T idx) {
-  auto p = allocator.device_zone_map_.find(idx * nr_dev());
-  if (p == allocator.device_zone_map_.end()) return {};
-  if (p->second.size() > 0)
-    return p->second[0];
+  auto table = layout();
+  auto &sub = table->sub_zone(idx * nr_dev());
+  if (sub.nr_mirrors > 0)
+    return sub.mirror(0);
   else {
     Error(logger_, "failed to get idx %x! fall back to default 0", idx);
     return {};
@@ -751,90 +689,116 @@ RaidMapItem RaidAutoZonedBlockDevice::getAutoDeviceZoneFromIdx(T idx) {
 }
 template <class T>
 T RaidAutoZonedBlockDevice::getAutoMappedDevicePos(T pos) {
-  // 第几个 RaidZone (raid_zone_idx) = 偏移量 / RaidZone 大小
-  auto raid_zone_idx = pos / zone_sz_;
-  // 找到这个偏移量对应着的 RaidZone 映射数据，映射到哪一个 Device 上的哪一个 Zone
-  RaidMapItem map_item = getAutoDeviceZone(pos);
-  // 找这个 RaidZone Index 对应的 RaidMode，即 0/1/c
-  auto mode_item = allocator.mode_map_[raid_zone_idx];
-  // 这个偏移量是逻辑上第几个 Block (Block Index) = 偏移量 / Block 大小
-  auto blk_idx = pos / block_sz_;
-  // if (mode_item.mode == RaidMode::RAID_NONE) {
-  //   return pos;
-  // } else
-  if (mode_item.mode == RaidMode::RAID0) {
-    // RAID0 逻辑：
-    // Device 上对应 Zone 的偏移（start或者说base）
-    auto base = map_item.zone_idx * def_dev()->GetZoneSize();
-    // 一个 RaidZone 有多少 Block (nr_blk_in_raid_zone) = RaidZone 大小 / Block 大小
-    auto nr_blk_in_raid_zone = zone_sz_ / block_sz_;
-    // blk_idx_raid_zone: Block Index 在一个 RaidZone 内的偏移量
-    //   = Block Index % 一个 RaidZone 有多少 Block
-    auto blk_idx_raid_zone = blk_idx % nr_blk_in_raid_zone;
-    // blk_idx_dev_zone: Block Index 在一个 Device Zone 内的偏移量
-    //   = Block Index 在一个 RaidZone 内的偏移量 / Device 数量
-    auto blk_idx_dev_zone = blk_idx_raid_zone / nr_dev();
-    auto offset_in_blk = pos % block_sz_;
-    auto offset_in_zone = blk_idx_dev_zone * block_sz_;
-    return base + offset_in_zone + offset_in_blk;
-  } else if (mode_item.mode == RaidMode::RAID1) {
-    // FIXME
-    return map_item.zone_idx * def_dev()->GetZoneSize() + pos % zone_sz_;
-  } else {
-    return map_item.zone_idx * def_dev()->GetZoneSize() +
-           ((blk_idx % (def_dev()->GetZoneSize() / block_sz_)) * block_sz_) +
-           pos % block_sz_;
-  }
+  uint64_t mapped_pos;
+  translate(*layout(), pos, &mapped_pos);
+  return static_cast<T>(mapped_pos);
 }
 template <class T>
 RaidMapItem RaidAutoZonedBlockDevice::getAutoDeviceZone(T pos) {
-  return allocator.device_zone_map_[getAutoDeviceZoneIdx(pos)][0];
+  uint64_t mapped_pos;
+  return translate(*layout(), pos, &mapped_pos);
 }
 template <class T>
 idx_t RaidAutoZonedBlockDevice::getAutoDeviceZoneIdx(T pos) {
+  return translate_sub_idx(*layout(), pos);
+}
+idx_t RaidAutoZonedBlockDevice::translate_sub_idx(
+    const RaidTranslationTable &table, uint64_t pos) const {
   auto raid_zone_idx = pos / zone_sz_;
-  auto raid_zone_inner_idx =
-      (pos - (raid_zone_idx * zone_sz_)) / def_dev()->GetZoneSize();
-  auto raid_block_idx = pos / block_sz_;
-  // index of block in this raid zone
-  auto raid_zone_block_idx =
-      raid_block_idx - (raid_zone_idx * (zone_sz_ / block_sz_));
-  auto mode_item = allocator.mode_map_[raid_zone_idx];
-  if (mode_item.mode == RaidMode::RAID_NONE ||
-      mode_item.mode == RaidMode::RAID_C || mode_item.mode == RaidMode::RAID1) {
+  auto mode = table.mode(raid_zone_idx);
+  if (mode == RaidMode::RAID_NONE || mode == RaidMode::RAID_C ||
+      mode == RaidMode::RAID1) {
+    auto raid_zone_inner_idx =
+        (pos - (raid_zone_idx * zone_sz_)) / def_dev()->GetZoneSize();
     return raid_zone_idx * nr_dev() + raid_zone_inner_idx;
-  } else if (mode_item.mode == RaidMode::RAID0) {
-    // Info(logger_, "\t[pos=%x] raid_zone_idx=%lx raid_zone_block_idx = %lx",
-    //      static_cast<uint32_t>(pos), raid_zone_idx, raid_zone_block_idx);
+  } else if (mode == RaidMode::RAID0) {
+    // index of block in this raid zone
+    auto raid_zone_block_idx = (pos % zone_sz_) / block_sz_;
     return raid_zone_idx * nr_dev() + raid_zone_block_idx % nr_dev();
   }
   Warn(logger_, "Cannot locate device zone at pos=%x",
        static_cast<uint32_t>(pos));
   return {};
 }
+RaidMapItem RaidAutoZonedBlockDevice::translate(
+    const RaidTranslationTable &table, uint64_t pos,
+    uint64_t *mapped_pos) const {
+  auto dev_zone_sz = def_dev()->GetZoneSize();
+  // 第几个 RaidZone (raid_zone_idx) = 偏移量 / RaidZone 大小
+  auto raid_zone_idx = pos / zone_sz_;
+  auto mode = table.mode(raid_zone_idx);
+  // 找到这个偏移量对应着的 RaidZone 映射数据，映射到哪一个 Device 上的哪一个 Zone
+  RaidMapItem map_item =
+      table.sub_zone(translate_sub_idx(table, pos)).mirror(0);
+  auto base = map_item.zone_idx * dev_zone_sz;
+  // 这个偏移量是逻辑上第几个 Block (Block Index) = 偏移量 / Block 大小
+  auto blk_idx = pos / block_sz_;
+  if (mode == RaidMode::RAID0) {
+    // RAID0 逻辑：Block 在一个 RaidZone 内的偏移量 / Device 数量
+    //   = Block 在一个 Device Zone 内的偏移量
+    auto blk_idx_dev_zone = (blk_idx % (zone_sz_ / block_sz_)) / nr_dev();
+    *mapped_pos = base + blk_idx_dev_zone * block_sz_ + pos % block_sz_;
+  } else if (mode == RaidMode::RAID1) {
+    // FIXME
+    *mapped_pos = base + pos % zone_sz_;
+  } else {
+    *mapped_pos = base + ((blk_idx % (dev_zone_sz / block_sz_)) * block_sz_) +
+                  pos % block_sz_;
+  }
+  return map_item;
+}
 Status RaidMapItem::DecodeFrom(Slice *input) {
   GetFixed32(input, &device_idx);
   GetFixed32(input, &zone_idx);
   GetFixed16(input, &invalid);
   return Status::OK();
 }
+void RaidMapItem::EncodeTo(std::string *output) const {
+  PutFixed32(output, device_idx);
+  PutFixed32(output, zone_idx);
+  PutFixed16(output, invalid);
+}
 Status RaidModeItem::DecodeFrom(Slice *input) {
   GetFixed32(input, reinterpret_cast<uint32_t *>(&mode));
   GetFixed32(input, &option);
   return Status::OK();
 }
+void RaidModeItem::EncodeTo(std::string *output) const {
+  PutFixed32(output, static_cast<uint32_t>(mode));
+  PutFixed32(output, option);
+}
+void RaidInfoAppend::EncodeTo(std::string *output) const {
+  // format read by AquaFS::DecodeRaidAppendFrom
+  uint32_t nr_items = 0;
+  for (auto &p : device_zone_map) nr_items += p.second.size();
+  PutFixed32(output, nr_items);
+  for (auto &p : device_zone_map) {
+    for (auto &m : p.second) {
+      PutFixed32(output, p.first);
+      m.EncodeTo(output);
+    }
+  }
+  PutFixed32(output, static_cast<uint32_t>(mode_map.size()));
+  for (auto &p : mode_map) {
+    PutFixed32(output, p.first);
+    p.second.EncodeTo(output);
+  }
+}
 
 Status RaidAutoZonedBlockDevice::ScanAndHandleOffline() {
   idx_t handle_device = 0;
   idx_t handle_zone_sub = 0;
   idx_t handle_device_zone = 0;
   bool will_handle = false;
+  std::lock_guard<std::mutex> layout_lock(layout_mtx_);
+  // zones go offline behind our back, take fresh reports once
+  refresh_dev_zones();
+  std::unique_lock<std::mutex> dev_zones_lock(dev_zones_mtx_);
   for (auto &p : allocator.device_zone_map_) {
     for (auto &&m : p.second) {
       auto d = m.device_idx;
       auto z = m.zone_idx;
-      auto zones = devices_[d]->ListZones();
-      if (devices_[d]->ZoneIsOffline(zones, z)) {
+      if (devices_[d]->ZoneIsOffline(dev_zones_[d], z)) {
         will_handle = true;
         handle_device = d;
         handle_device_zone = z;
@@ -846,6 +810,7 @@ Status RaidAutoZonedBlockDevice::ScanAndHandleOffline() {
     }
     if (will_handle) break;
   }
+  dev_zones_lock.unlock();
   if (will_handle) {
     auto mode = allocator.mode_map_[handle_zone_sub / nr_dev()].mode;
     auto &mp = allocator.device_zone_map_[handle_zone_sub];
@@ -884,6 +849,7 @@ Status RaidAutoZonedBlockDevice::ScanAndHandleOffline() {
               handle_zone_sub, handle_device, handle_device_zone,
               status.getState());
       }
+      publish_layout();
       if (mode == RaidMode::RAID1) {
         std::string mp_info =
             "[mp] raid zone " + std::to_string(handle_zone_sub) + ": ";
@@ -901,27 +867,17 @@ Status RaidAutoZonedBlockDevice::ScanAndHandleOffline() {
         auto fine = std::find_if(
             mp.begin(), mp.end(),
             [&](const RaidMapItem &item) { return item != *restoring; });
-        auto zones = devices_[fine->device_idx]->ListZones();
-        auto wp = devices_[fine->device_idx]->ZoneWp(zones, fine->zone_idx);
-        auto start =
-            devices_[fine->device_idx]->ZoneStart(zones, fine->zone_idx);
+        uint64_t wp, start;
+        {
+          std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+          wp = dev_zone(fine->device_idx, fine->zone_idx)->wp;
+          start = dev_zone(fine->device_idx, fine->zone_idx)->start;
+        }
         Info(logger_, "fine zone: dev=%x, zone=%x, wp=%lx, start=%lx",
              fine->device_idx, fine->zone_idx, wp, start);
         assert(wp >= start);
         auto sz = wp - start;
-        char *buf = nullptr;
-        if (posix_memalign((void **)(&buf), getpagesize(), sz)) {
-          return Status::IOError("Allocate memory failed!");
-        }
-        auto read_sz = devices_[fine->device_idx]->Read(
-            buf, static_cast<int>(sz),
-            restoring->zone_idx * zone_sz_ / nr_dev(), false);
-        if (read_sz < 0) {
-          Error(logger_, "Cannot read data from dev %x zone %x, sz=%lx",
-                fine->device_idx, fine->zone_idx, sz);
-          free(buf);
-          return Status::IOError("Cannot recover data");
-        }
+        auto read_start = restoring->zone_idx * zone_sz_ / nr_dev();
         // restore data
         bool tmp_offline = false;
         uint64_t tmp_max_capacity = 0;
@@ -939,15 +895,30 @@ Status RaidAutoZonedBlockDevice::ScanAndHandleOffline() {
         status = devices_[write_dev]->Reset(write_start, &tmp_offline,
                                             &tmp_max_capacity);
         assert(status.ok());
-        auto written = devices_[write_dev]->Write(buf, sz, write_start);
-        if (static_cast<decltype(sz)>(written) != sz) {
-          Error(logger_, "Cannot write restored data! written=%x, cause: %s",
-                written, strerror(errno));
-          free(buf);
-          return Status::IOError("Cannot recover data");
-        } else {
-          free(buf);
+        // copy through a pooled buffer in chunks instead of a zone-sized one
+        IOBuffer buf = buffer_pool_->Allocate(std::min<uint64_t>(sz, 1 << 20));
+        if (sz > 0 && !buf) {
+          return Status::IOError("Allocate memory failed!");
+        }
+        for (uint64_t copied = 0; copied < sz;) {
+          auto chunk = std::min<uint64_t>(sz - copied, buf.capacity());
+          auto read_sz = devices_[fine->device_idx]->Read(
+              buf.data(), static_cast<int>(chunk), read_start + copied, false);
+          if (read_sz <= 0) {
+            Error(logger_, "Cannot read data from dev %x zone %x, sz=%lx",
+                  fine->device_idx, fine->zone_idx, sz);
+            return Status::IOError("Cannot recover data");
+          }
+          auto written = devices_[write_dev]->Write(buf.data(), read_sz,
+                                                    write_start + copied);
+          if (written != read_sz) {
+            Error(logger_, "Cannot write restored data! written=%x, cause: %s",
+                  written, strerror(errno));
+            return Status::IOError("Cannot recover data");
+          }
+          copied += read_sz;
         }
+        refresh_dev_zones(write_dev);
       }
     } else {
       Error(
@@ -959,10 +930,272 @@ Status RaidAutoZonedBlockDevice::ScanAndHandleOffline() {
   }
   return Status::OK();
 }
+void RaidAutoZonedBlockDevice::GetZoneHeat(std::vector<RaidZoneHeat> *zones) {
+  zones->clear();
+  if (!heat_) return;
+  auto table = layout();
+  for (idx_t idx = 0; idx < nr_zones_; idx++) {
+    auto mode = table->mode(idx);
+    if (mode == RaidMode::RAID_NONE) continue;
+    uint64_t read = heat_[idx].read.load();
+    uint64_t write = heat_[idx].write.load();
+    // requests counted meanwhile are kept
+    heat_[idx].read -= read - read / 2;
+    heat_[idx].write -= write - write / 2;
+    zones->push_back({idx, mode, read, write});
+  }
+}
+
+size_t RaidAutoZonedBlockDevice::FreeDeviceZones() {
+  std::lock_guard<std::mutex> lock(layout_mtx_);
+  return allocator.nrFreeZones();
+}
+
+IOStatus RaidAutoZonedBlockDevice::PrepareConversion(
+    idx_t raid_zone_idx, RaidMode mode, RaidZoneConversion *conv) {
+  if (mode != RaidMode::RAID0 && mode != RaidMode::RAID1 &&
+      mode != RaidMode::RAID_C)
+    return IOStatus::InvalidArgument("RAID-A: cannot convert zones to raid" +
+                                     std::string(raid_mode_str(mode)));
+  conv->raid_zone_idx = raid_zone_idx;
+  conv->to = {mode, 0};
+  {
+    std::lock_guard<std::mutex> lock(layout_mtx_);
+    auto f = allocator.mode_map_.find(raid_zone_idx);
+    if (f == allocator.mode_map_.end() ||
+        f->second.mode == RaidMode::RAID_NONE || f->second.mode == mode)
+      return IOStatus::InvalidArgument("RAID-A: zone not convertible");
+    conv->from = f->second;
+    conv->from_subs.clear();
+    for (idx_t i = 0; i < nr_dev(); i++) {
+      auto fm = allocator.device_zone_map_.find(raid_zone_idx * nr_dev() + i);
+      if (fm == allocator.device_zone_map_.end() || fm->second.empty())
+        return IOStatus::Corruption("RAID-A: zone not fully mapped");
+      conv->from_subs.push_back(fm->second);
+    }
+    auto s = allocator.takeZones(mode == RaidMode::RAID1 ? 2 : 1,
+                                 &conv->to_subs);
+    if (!s.ok()) return IOStatus::NoSpace("RAID-A: no free zones to convert");
+  }
+  // the data held by the zone, as flush_zone_info counts it
+  uint64_t size = 0;
+  {
+    std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+    for (auto &sub : conv->from_subs) {
+      auto z = dev_zone(sub.front().device_idx, sub.front().zone_idx);
+      size += z->wp - z->start;
+    }
+  }
+  auto s = copy_zone(*conv, size);
+  if (!s.ok()) {
+    Error(logger_, "RAID-A: converting zone %x to raid%s failed: %s",
+          raid_zone_idx, raid_mode_str(mode), s.ToString().c_str());
+    AbortConversion(*conv);
+    return s;
+  }
+  Info(logger_, "RAID-A: copied zone %x (%lx bytes) from raid%s to raid%s",
+       raid_zone_idx, size, raid_mode_str(conv->from.mode),
+       raid_mode_str(mode));
+  return IOStatus::OK();
+}
+
+IOStatus RaidAutoZonedBlockDevice::copy_zone(const RaidZoneConversion &conv,
+                                             uint64_t size) {
+  const uint64_t dev_zone_sz = def_dev()->GetZoneSize();
+  const uint64_t start = conv.raid_zone_idx * zone_sz_;
+  const auto mode = conv.to.mode;
+  IOStatus s;
+
+  // zones taken by a conversion that crashed may still hold its copy
+  for (auto &sub : conv.to_subs) {
+    for (auto &m : sub) {
+      bool written;
+      {
+        std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+        auto z = dev_zone(m.device_idx, m.zone_idx);
+        written = z->wp != z->start;
+      }
+      if (!written) continue;
+      bool offline = false;
+      uint64_t max_capacity = 0;
+      s = devices_[m.device_idx]->Reset(m.zone_idx * dev_zone_sz, &offline,
+                                        &max_capacity);
+      if (!s.ok()) return s;
+      dev_zone_reset(m.device_idx, m.zone_idx, offline, max_capacity);
+      if (offline) return IOStatus::IOError("RAID-A: zone went offline");
+    }
+  }
+
+  IOBuffer buf = buffer_pool_->Allocate(1 << 20);
+  if (!buf) return IOStatus::IOError("Allocate memory failed!");
+  for (uint64_t copied = 0; copied < size;) {
+    // never cross a device zone, so a RAID1 chunk is one write per mirror
+    auto chunk = static_cast<uint32_t>(
+        std::min<uint64_t>({size - copied, buf.capacity(),
+                            dev_zone_sz - copied % dev_zone_sz}));
+    int r = Read(buf.data(), static_cast<int>(chunk), start + copied, true);
+    if (r != static_cast<int>(chunk))
+      return IOStatus::IOError("RAID-A: cannot read zone to convert");
+    if (mode == RaidMode::RAID1) {
+      std::vector<RaidMirror> mirrors;
+      for (auto &m : conv.to_subs[copied / dev_zone_sz])
+        mirrors.push_back(
+            {m.device_idx, m.zone_idx * dev_zone_sz + copied % dev_zone_sz});
+      r = WriteMirrored(mirrors, buf.data(), chunk);
+      if (r != static_cast<int>(chunk))
+        return IOStatus::IOError("RAID-A: cannot write converted zone");
+      for (auto &mirror : mirrors)
+        dev_zone_written(mirror.device_idx, mirror.pos, chunk);
+    } else if (mode == RaidMode::RAID0) {
+      // same striping as translate()
+      std::vector<RaidStripeUnit> units;
+      for (uint64_t off = 0; off < chunk; off += block_sz_) {
+        auto blk_idx = (copied + off) / block_sz_;
+        auto &m = conv.to_subs[blk_idx % nr_dev()].front();
+        units.push_back({m.device_idx, buf.data() + off, block_sz_,
+                         m.zone_idx * dev_zone_sz +
+                             (blk_idx / nr_dev()) * block_sz_});
+      }
+      r = SubmitStriped(units, true, false);
+      if (r != static_cast<int>(chunk))
+        return IOStatus::IOError("RAID-A: cannot write converted zone");
+      for (auto &unit : units)
+        dev_zone_written(unit.device_idx, unit.pos, unit.size);
+    } else {
+      auto &m = conv.to_subs[copied / dev_zone_sz].front();
+      auto pos = m.zone_idx * dev_zone_sz + copied % dev_zone_sz;
+      for (uint32_t written = 0; written < chunk;) {
+        r = devices_[m.device_idx]->Write(buf.data() + written,
+                                          chunk - written, pos + written);
+        if (r <= 0)
+          return IOStatus::IOError("RAID-A: cannot write converted zone");
+        dev_zone_written(m.device_idx, pos + written, r);
+        written += r;
+      }
+    }
+    copied += chunk;
+  }
+  // reading the zone for the copy does not make it hot
+  auto &heat = heat_[conv.raid_zone_idx].read;
+  uint64_t read = heat.load();
+  while (!heat.compare_exchange_weak(read, read - std::min(read, size))) {
+  }
+
+  // the zone was full, keep it full in the new layout too
+  for (auto &sub : conv.to_subs) {
+    for (auto &m : sub) {
+      bool full;
+      {
+        std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+        auto z = dev_zone(m.device_idx, m.zone_idx);
+        full = z->wp >= z->start + z->capacity;
+      }
+      if (full) continue;
+      s = devices_[m.device_idx]->Finish(m.zone_idx * dev_zone_sz);
+      if (!s.ok()) return s;
+      dev_zone_finish(m.device_idx, m.zone_idx);
+    }
+  }
+  return IOStatus::OK();
+}
+
+void RaidAutoZonedBlockDevice::CommitConversion(const RaidZoneConversion &conv,
+                                                std::string *record) {
+  std::lock_guard<std::mutex> lock(layout_mtx_);
+  RetiredZones retired{layout(), {}};
+  for (idx_t i = 0; i < nr_dev(); i++)
+    allocator.device_zone_map_[conv.raid_zone_idx * nr_dev() + i] =
+        conv.to_subs[i];
+  allocator.setMappingMode(conv.raid_zone_idx, conv.to);
+  publish_layout();
+  layout_diverged_ = true;
+  // zones mapped again, by reverting a conversion, must not be reset
+  for (auto &r : retired_)
+    for (auto &sub : conv.to_subs)
+      for (auto &m : sub)
+        r.zones.erase(std::remove(r.zones.begin(), r.zones.end(), m),
+                      r.zones.end());
+  // requests which took the table before the swap may still read these
+  for (auto &sub : conv.from_subs)
+    retired.zones.insert(retired.zones.end(), sub.begin(), sub.end());
+  retired_.push_back(std::move(retired));
+  flush_zone_info();
+
+  if (record != nullptr) {
+    RaidInfoAppend info;
+    for (idx_t i = 0; i < nr_dev(); i++)
+      info.device_zone_map[conv.raid_zone_idx * nr_dev() + i] =
+          conv.to_subs[i];
+    info.mode_map[conv.raid_zone_idx] = conv.to;
+    info.EncodeTo(record);
+  }
+  Info(logger_, "RAID-A: zone %x is raid%s now", conv.raid_zone_idx,
+       raid_mode_str(conv.to.mode));
+}
+
+void RaidAutoZonedBlockDevice::AbortConversion(
+    const RaidZoneConversion &conv) {
+  std::lock_guard<std::mutex> lock(layout_mtx_);
+  for (auto &sub : conv.to_subs)
+    for (auto &m : sub) release_zone(m);
+}
+
+void RaidAutoZonedBlockDevice::ReclaimRetiredZones() {
+  std::lock_guard<std::mutex> lock(layout_mtx_);
+  // oldest first, a table may also map zones retired after it
+  while (!retired_.empty() && retired_.front().table.use_count() == 1) {
+    for (auto &m : retired_.front().zones) release_zone(m);
+    retired_.pop_front();
+  }
+}
+
+void RaidAutoZonedBlockDevice::release_zone(const RaidMapItem &m) {
+  if (allocator.isOffline(m.device_idx, m.zone_idx)) return;
+  bool written;
+  {
+    std::lock_guard<std::mutex> lock(dev_zones_mtx_);
+    auto z = dev_zone(m.device_idx, m.zone_idx);
+    written = z->wp != z->start;
+  }
+  if (written) {
+    bool offline = false;
+    uint64_t max_capacity = 0;
+    auto s = devices_[m.device_idx]->Reset(
+        m.zone_idx * def_dev()->GetZoneSize(), &offline, &max_capacity);
+    if (!s.ok()) {
+      // keep it taken rather than hand out a zone with stale data
+      Error(logger_, "RAID-A: cannot reset dev %x zone %x: %s", m.device_idx,
+            m.zone_idx, s.ToString().c_str());
+      return;
+    }
+    dev_zone_reset(m.device_idx, m.zone_idx, offline, max_capacity);
+    if (offline) allocator.setOffline(m.device_idx, m.zone_idx);
+  }
+  allocator.removeMapping(m.device_idx, m.zone_idx);
+}
+
+bool RaidAutoZonedBlockDevice::EncodeLayout(std::string *record) {
+  std::lock_guard<std::mutex> lock(layout_mtx_);
+  if (!layout_diverged_) return false;
+  RaidInfoAppend info;
+  for (auto &p : allocator.getDeviceZoneMap()) info.device_zone_map.insert(p);
+  for (auto &p : allocator.getModeMap()) info.mode_map.insert(p);
+  info.EncodeTo(record);
+  return true;
+}
+
+void RaidAutoZonedBlockDevice::ResetUnmappedZones() {
+  std::lock_guard<std::mutex> lock(layout_mtx_);
+  for (idx_t d = 0; d < nr_dev(); d++)
+    for (idx_t z = 0; z < nr_zones_; z++)
+      if (!allocator.isUsed(d, z)) release_zone({d, z, 0});
+}
+
 void RaidAutoZonedBlockDevice::setZoneOffline(unsigned int idx,
                                               unsigned int idx2, bool offline) {
   if (offline) Warn(logger_, "setting dev %x zone %x to offline!", idx, idx2);
   devices_[idx]->setZoneOffline(idx2, 0, offline);
+  refresh_dev_zones(idx);
 }
 
 }  // namespace AQUAFS_NAMESPACE
\ No newline at end of file
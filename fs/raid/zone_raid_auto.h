@@ -7,12 +7,47 @@
 
 #include <gflags/gflags.h>
 
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "zone_raid.h"
 #include "zone_raid_allocator.h"
+#include "zone_raid_table.h"
 
 DECLARE_string(raid_auto_default);
+DECLARE_bool(raid_auto_convert);
+DECLARE_uint64(raid_auto_convert_interval);
+DECLARE_string(raid_auto_cold_mode);
+DECLARE_uint64(raid_auto_hot_read);
+DECLARE_uint64(raid_auto_cold_read);
+DECLARE_uint32(raid_auto_convert_max);
+DECLARE_uint32(raid_auto_free_reserve);
 
 namespace aquafs {
+
+/* Bytes read from and written to a raid zone, decayed every pass */
+struct RaidZoneHeat {
+  idx_t raid_zone_idx;
+  RaidMode mode;
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+};
+
+/* A raid zone moving to another mode, with its device zones before and
+ * after, per raid sub zone */
+struct RaidZoneConversion {
+  idx_t raid_zone_idx{};
+  RaidModeItem from{}, to{};
+  std::vector<std::vector<RaidMapItem>> from_subs, to_subs;
+
+  [[nodiscard]] RaidZoneConversion Reversed() const {
+    return {raid_zone_idx, to, from, to_subs, from_subs};
+  }
+};
+
 class RaidAutoZonedBlockDevice : public AbstractRaidZonedBlockDevice {
  public:
   // template <typename K, typename V>
@@ -30,6 +65,64 @@ class RaidAutoZonedBlockDevice : public AbstractRaidZonedBlockDevice {
 
   void flush_zone_info();
 
+  // current translation table, replaced as a whole by publish_layout()
+  std::shared_ptr<const RaidTranslationTable> layout_;
+
+  // snapshots the allocator maps for the I/O path, after every change
+  void publish_layout();
+  [[nodiscard]] std::shared_ptr<const RaidTranslationTable> layout() const {
+    return std::atomic_load(&layout_);
+  }
+  // device zone holding pos and the position on that device
+  RaidMapItem translate(const RaidTranslationTable &table, uint64_t pos,
+                        uint64_t *mapped_pos) const;
+  [[nodiscard]] idx_t translate_sub_idx(const RaidTranslationTable &table,
+                                        uint64_t pos) const;
+
+  // serializes layout changes: conversions, layout records and offline
+  // zone recovery. Taken before dev_zones_mtx_
+  std::mutex layout_mtx_;
+  // set once the layout is no longer the one Open derives from the flags,
+  // snapshots have to carry it from then on
+  bool layout_diverged_ = false;
+
+  // device zones a conversion moved away from, reset once no request holds
+  // a table mapping them
+  struct RetiredZones {
+    std::shared_ptr<const RaidTranslationTable> table;
+    std::vector<RaidMapItem> zones;
+  };
+  std::deque<RetiredZones> retired_;
+
+  // caller holds layout_mtx_
+  void release_zone(const RaidMapItem &m);
+  IOStatus copy_zone(const RaidZoneConversion &conv, uint64_t size);
+
+  struct ZoneHeatCounter {
+    std::atomic<uint64_t> read{0};
+    std::atomic<uint64_t> write{0};
+  };
+  std::unique_ptr<ZoneHeatCounter[]> heat_;
+
+  // zone reports of the devices, taken in bulk by refresh_dev_zones() and
+  // kept in step by Reset, Finish, Close and Write, so zone queries need no
+  // report ioctl
+  std::mutex dev_zones_mtx_;
+  std::vector<std::unique_ptr<ZoneList>> dev_zones_;
+
+  bool refresh_dev_zones();
+  bool refresh_dev_zones(idx_t device_idx);
+  // caller holds dev_zones_mtx_
+  raid_zone_t *dev_zone(idx_t device_idx, idx_t zone_idx) {
+    return reinterpret_cast<raid_zone_t *>(dev_zones_[device_idx]->GetData()) +
+           zone_idx;
+  }
+  void dev_zone_reset(idx_t device_idx, idx_t zone_idx, bool offline,
+                      uint64_t max_capacity);
+  void dev_zone_finish(idx_t device_idx, idx_t zone_idx);
+  void dev_zone_close(idx_t device_idx, idx_t zone_idx);
+  void dev_zone_written(idx_t device_idx, uint64_t pos, uint64_t size);
+
   void syncBackendInfo() override;
 
  public:
@@ -71,6 +164,38 @@ class RaidAutoZonedBlockDevice : public AbstractRaidZonedBlockDevice {
 
   Status ScanAndHandleOffline();
 
+  /* Heat of every data zone, halving the counters */
+  void GetZoneHeat(std::vector<RaidZoneHeat> *zones);
+  [[nodiscard]] size_t FreeDeviceZones();
+  [[nodiscard]] size_t TotalDeviceZones() const {
+    return nr_dev() * static_cast<size_t>(nr_zones_);
+  }
+
+  /*
+   * Copies a full raid zone into newly taken device zones laid out as mode.
+   * Requests keep using the current layout meanwhile, the caller has to
+   * keep writers and resets off the zone until committed or aborted.
+   */
+  IOStatus PrepareConversion(idx_t raid_zone_idx, RaidMode mode,
+                             RaidZoneConversion *conv);
+  /* Switches the zone to the new layout and encodes its kRaidInfoAppend
+   * payload to record, the old device zones are reset later */
+  void CommitConversion(const RaidZoneConversion &conv, std::string *record);
+  /* Gives back the device zones of a conversion never committed */
+  void AbortConversion(const RaidZoneConversion &conv);
+  void ReclaimRetiredZones();
+
+  [[nodiscard]] bool layout_diverged() {
+    std::lock_guard<std::mutex> lock(layout_mtx_);
+    return layout_diverged_;
+  }
+  /* The whole layout as a kRaidInfoAppend payload, false if it still is
+   * the default one */
+  bool EncodeLayout(std::string *record);
+  /* Resets device zones left written but unmapped by an interrupted
+   * conversion, after the layout was recovered */
+  void ResetUnmappedZones();
+
   ~RaidAutoZonedBlockDevice() override = default;
 
   void setZoneOffline(unsigned int idx, unsigned int idx2,
@@ -134,6 +259,8 @@ class RaidInfoAppend {
  public:
   RaidAutoZonedBlockDevice::device_zone_map_t device_zone_map;
   RaidAutoZonedBlockDevice::mode_map_t mode_map;
+
+  void EncodeTo(std::string *output) const;
 };
 }  // namespace AQUAFS_NAMESPACE
 
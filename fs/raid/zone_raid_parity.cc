@@ -0,0 +1,181 @@
+#include "zone_raid_parity.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace aquafs {
+
+namespace {
+
+struct GfTables {
+  uint8_t exp[512];
+  uint8_t log[256];
+
+  GfTables() : exp(), log() {
+    unsigned int x = 1;
+    for (unsigned int i = 0; i < 255; i++) {
+      exp[i] = exp[i + 255] = static_cast<uint8_t>(x);
+      log[x] = static_cast<uint8_t>(i);
+      x <<= 1;
+      if (x & 0x100) x ^= 0x11d;
+    }
+  }
+};
+
+const GfTables &gf() {
+  static const GfTables tables;
+  return tables;
+}
+
+uint8_t gf_mul(uint8_t a, uint8_t b) {
+  if (a == 0 || b == 0) return 0;
+  return gf().exp[gf().log[a] + gf().log[b]];
+}
+
+uint8_t gf_inv(uint8_t a) { return gf().exp[255 - gf().log[a]]; }
+
+// 16 bytes a lane, an SSE2 or NEON register; the compiler lowers the lane
+// operations to the vector instructions of the target
+typedef uint8_t parity_vec_t __attribute__((vector_size(16)));
+
+parity_vec_t load_vec(const char *p) {
+  parity_vec_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+void store_vec(char *p, parity_vec_t v) { memcpy(p, &v, sizeof(v)); }
+
+// multiply every byte by g = 2
+parity_vec_t mul2_vec(parity_vec_t v) {
+  parity_vec_t carry = v >> 7;
+  return (v << 1) ^ (carry * static_cast<uint8_t>(0x1d));
+}
+
+uint8_t mul2(uint8_t v) {
+  return static_cast<uint8_t>((v << 1) ^ ((v & 0x80) ? 0x1d : 0));
+}
+
+}  // namespace
+
+uint8_t gf_exp(unsigned int n) { return gf().exp[n % 255]; }
+
+void parity_xor(char *dst, const char *src, size_t len) {
+  size_t i = 0;
+  for (; i + sizeof(parity_vec_t) <= len; i += sizeof(parity_vec_t))
+    store_vec(dst + i, load_vec(dst + i) ^ load_vec(src + i));
+  for (; i < len; i++) dst[i] ^= src[i];
+}
+
+void parity_gf_mul_xor(char *dst, const char *src, uint8_t coef, size_t len) {
+  if (coef == 0) return;
+  if (coef == 1) {
+    parity_xor(dst, src, len);
+    return;
+  }
+  uint8_t table[256];
+  for (unsigned int b = 0; b < 256; b++)
+    table[b] = gf_mul(coef, static_cast<uint8_t>(b));
+  auto d = reinterpret_cast<uint8_t *>(dst);
+  auto s = reinterpret_cast<const uint8_t *>(src);
+  for (size_t i = 0; i < len; i++) d[i] ^= table[s[i]];
+}
+
+void parity_gen(const std::vector<const char *> &data, size_t len, char *p,
+                char *q) {
+  if (data.empty()) return;
+  auto last = data.size() - 1;
+  size_t i = 0;
+  // Horner's rule from the last chunk down: Q = ((D_k-1 * g) ^ D_k-2) * g ...
+  for (; i + sizeof(parity_vec_t) <= len; i += sizeof(parity_vec_t)) {
+    parity_vec_t vp = load_vec(data[last] + i);
+    parity_vec_t vq = vp;
+    for (auto j = last; j-- > 0;) {
+      parity_vec_t d = load_vec(data[j] + i);
+      vp ^= d;
+      if (q) vq = mul2_vec(vq) ^ d;
+    }
+    store_vec(p + i, vp);
+    if (q) store_vec(q + i, vq);
+  }
+  for (; i < len; i++) {
+    auto vp = static_cast<uint8_t>(data[last][i]);
+    auto vq = vp;
+    for (auto j = last; j-- > 0;) {
+      auto d = static_cast<uint8_t>(data[j][i]);
+      vp ^= d;
+      vq = mul2(vq) ^ d;
+    }
+    p[i] = static_cast<char>(vp);
+    if (q) q[i] = static_cast<char>(vq);
+  }
+}
+
+bool parity_rebuild(const std::vector<char *> &chunks, size_t nr_data,
+                    size_t len, const std::vector<size_t> &lost) {
+  auto nr_parity = chunks.size() - nr_data;
+  if (lost.size() > nr_parity) return false;
+  std::vector<size_t> lost_data;
+  bool lost_p = false, lost_q = false;
+  for (auto c : lost) {
+    if (c < nr_data)
+      lost_data.push_back(c);
+    else if (c == nr_data)
+      lost_p = true;
+    else
+      lost_q = true;
+  }
+  std::sort(lost_data.begin(), lost_data.end());
+  char *p = chunks[nr_data];
+  char *q = nr_parity > 1 ? chunks[nr_data + 1] : nullptr;
+
+  // syndromes of the surviving data, the lost chunks taken as zero
+  auto partial = [&](char *out, const char *parity, bool with_q) {
+    memcpy(out, parity, len);
+    for (size_t j = 0; j < nr_data; j++) {
+      if (std::find(lost_data.begin(), lost_data.end(), j) != lost_data.end())
+        continue;
+      if (with_q)
+        parity_gf_mul_xor(out, chunks[j], gf_exp(j), len);
+      else
+        parity_xor(out, chunks[j], len);
+    }
+  };
+
+  std::vector<char> tmp(len);
+  if (lost_data.size() == 1) {
+    auto x = lost_data[0];
+    if (!lost_p) {
+      partial(chunks[x], p, false);
+    } else {
+      if (q == nullptr || lost_q) return false;
+      // g^x * D_x = Q ^ sum(g^j * D_j), j != x
+      partial(tmp.data(), q, true);
+      memset(chunks[x], 0, len);
+      parity_gf_mul_xor(chunks[x], tmp.data(), gf_inv(gf_exp(x)), len);
+    }
+  } else if (lost_data.size() == 2) {
+    if (q == nullptr || lost_p || lost_q) return false;
+    auto x = lost_data[0], y = lost_data[1];
+    // pd = D_x ^ D_y, qd = g^x * D_x ^ g^y * D_y, so
+    // D_x = (qd ^ g^y * pd) / (g^x ^ g^y)
+    std::vector<char> pd(len);
+    partial(pd.data(), p, false);
+    partial(tmp.data(), q, true);
+    parity_gf_mul_xor(tmp.data(), pd.data(), gf_exp(y), len);
+    memset(chunks[x], 0, len);
+    parity_gf_mul_xor(chunks[x], tmp.data(),
+                      gf_inv(gf_exp(x) ^ gf_exp(y)), len);
+    memcpy(chunks[y], pd.data(), len);
+    parity_xor(chunks[y], chunks[x], len);
+  }
+
+  if (lost_p || lost_q) {
+    std::vector<const char *> data(chunks.begin(),
+                                   chunks.begin() + static_cast<long>(nr_data));
+    parity_gen(data, len, lost_p ? p : tmp.data(), lost_q ? q : nullptr);
+  }
+  return true;
+}
+
+}  // namespace aquafs
@@ -0,0 +1,41 @@
+#ifndef ROCKSDB_ZONE_RAID_PARITY_H
+#define ROCKSDB_ZONE_RAID_PARITY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace aquafs {
+
+/*
+ * Parity of RAID5 and RAID6 stripes. P is the XOR of the data chunks, Q the
+ * Reed-Solomon syndrome sum(g^j * D_j) over GF(2^8) with generator g = 2 and
+ * polynomial 0x11d, the same code as Linux md.
+ */
+
+/* g^n in GF(2^8) */
+uint8_t gf_exp(unsigned int n);
+
+/* dst ^= src */
+void parity_xor(char *dst, const char *src, size_t len);
+
+/* dst ^= coef * src in GF(2^8) */
+void parity_gf_mul_xor(char *dst, const char *src, uint8_t coef, size_t len);
+
+/* P and Q of the data chunks, each len bytes; no Q if q is nullptr */
+void parity_gen(const std::vector<const char *> &data, size_t len, char *p,
+                char *q);
+
+/*
+ * Rebuilds lost chunks of a stripe in place. chunks holds the data chunks
+ * followed by P and, for RAID6, Q; lost are indexes into chunks whose
+ * content is gone, at most as many as there are parity chunks. The other
+ * chunks must hold their content.
+ * Returns false if lost chunks cannot be rebuilt.
+ */
+bool parity_rebuild(const std::vector<char *> &chunks, size_t nr_data,
+                    size_t len, const std::vector<size_t> &lost);
+
+}  // namespace aquafs
+
+#endif  // ROCKSDB_ZONE_RAID_PARITY_H
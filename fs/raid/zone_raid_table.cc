@@ -0,0 +1,33 @@
+#include "zone_raid_table.h"
+
+#include <algorithm>
+
+namespace aquafs {
+
+RaidTranslationTable::RaidTranslationTable(const ZoneRaidAllocator &allocator,
+                                           idx_t nr_dev)
+    : nr_dev_(nr_dev) {
+  size_t nr_subs = 0;
+  for (const auto &p : allocator.getDeviceZoneMap())
+    nr_subs = std::max<size_t>(nr_subs, p.first + 1);
+  for (const auto &p : allocator.getModeMap())
+    nr_subs = std::max<size_t>(nr_subs, (p.first + 1) * nr_dev_);
+  subs_.resize(nr_subs);
+
+  for (const auto &p : allocator.getModeMap())
+    for (idx_t i = 0; i < nr_dev_; i++)
+      subs_[p.first * nr_dev_ + i].mode = p.second.mode;
+  for (const auto &p : allocator.getDeviceZoneMap()) {
+    auto &sub = subs_[p.first];
+    sub.nr_mirrors = static_cast<uint32_t>(p.second.size());
+    if (sub.nr_mirrors > SubZone::kInlineMirrors) {
+      spills_.push_back(p.second);
+      sub.spill = &spills_.back();
+      continue;
+    }
+    for (uint32_t i = 0; i < sub.nr_mirrors; i++)
+      sub.slots[i] = {p.second[i].device_idx, p.second[i].zone_idx};
+  }
+}
+
+}  // namespace aquafs
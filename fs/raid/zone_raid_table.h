@@ -0,0 +1,59 @@
+#ifndef ROCKSDB_ZONE_RAID_TABLE_H
+#define ROCKSDB_ZONE_RAID_TABLE_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "zone_raid_allocator.h"
+
+namespace aquafs {
+
+/*
+ * Read-only snapshot of the RAID-A layout for the I/O path: one packed
+ * entry per raid sub zone (nr_dev per raid zone), holding the mode of its
+ * raid zone and its device zones, so translating an address is an index
+ * computation and one load. A layout change builds a new table and
+ * publishes it, tables are never modified in place.
+ */
+class RaidTranslationTable {
+ public:
+  struct alignas(32) SubZone {
+    static constexpr uint32_t kInlineMirrors = 2;
+    struct Slot {
+      uint32_t device_idx;
+      uint32_t zone_idx;
+    };
+
+    RaidMode mode = RaidMode::RAID_NONE;
+    uint32_t nr_mirrors = 0;
+    Slot slots[kInlineMirrors]{};
+    // all mappings, only set when there are more than the inline slots
+    const std::vector<RaidMapItem> *spill = nullptr;
+
+    [[nodiscard]] RaidMapItem mirror(uint32_t i) const {
+      if (spill != nullptr) return (*spill)[i];
+      return {slots[i].device_idx, slots[i].zone_idx, 0};
+    }
+  };
+  static_assert(sizeof(SubZone) == 32, "two sub zones per cache line");
+
+  RaidTranslationTable(const ZoneRaidAllocator &allocator, idx_t nr_dev);
+
+  [[nodiscard]] const SubZone &sub_zone(idx_t sub_idx) const {
+    return sub_idx < subs_.size() ? subs_[sub_idx] : unmapped_;
+  }
+  [[nodiscard]] RaidMode mode(idx_t raid_zone_idx) const {
+    return sub_zone(raid_zone_idx * nr_dev_).mode;
+  }
+
+ private:
+  idx_t nr_dev_;
+  std::vector<SubZone> subs_;
+  std::deque<std::vector<RaidMapItem>> spills_;
+  SubZone unmapped_{};
+};
+
+}  // namespace aquafs
+
+#endif  // ROCKSDB_ZONE_RAID_TABLE_H
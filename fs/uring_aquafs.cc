@@ -0,0 +1,238 @@
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "uring_aquafs.h"
+
+#include <cerrno>
+
+namespace aquafs {
+
+UringEngine::UringEngine(unsigned int depth, int read_f, int read_direct_f,
+                         int write_f)
+    : depth_(depth), fds_{read_f, read_direct_f, write_f} {}
+
+UringEngine::~UringEngine() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  for (auto r : free_rings_) DeleteRing(r);
+  free_rings_.clear();
+}
+
+IOStatus UringEngine::Open() {
+  Ring *r = AcquireRing();
+  if (r == nullptr) return IOStatus::NotSupported("io_uring is not available");
+  ReleaseRing(r, false);
+  return IOStatus::OK();
+}
+
+UringEngine::Ring *UringEngine::NewRing() {
+  auto r = new Ring();
+  if (io_uring_queue_init(depth_, &r->ring, 0) < 0) {
+    delete r;
+    return nullptr;
+  }
+  // the write fd is the last slot, so a read-only device registers two
+  unsigned int nr_fds = fds_[kWriteSlot] < 0 ? 2 : 3;
+  r->fixed_files = io_uring_register_files(&r->ring, fds_, nr_fds) == 0;
+  return r;
+}
+
+void UringEngine::DeleteRing(Ring *r) {
+  io_uring_queue_exit(&r->ring);
+  delete r;
+}
+
+UringEngine::Ring *UringEngine::AcquireRing() {
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (!free_rings_.empty()) {
+      Ring *r = free_rings_.back();
+      free_rings_.pop_back();
+      return r;
+    }
+    if (nr_rings_ >= kMaxRings) return nullptr;
+    nr_rings_++;
+  }
+  Ring *r = NewRing();
+  if (r == nullptr) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    nr_rings_--;
+  }
+  return r;
+}
+
+void UringEngine::ReleaseRing(Ring *r, bool broken) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (broken) {
+    DeleteRing(r);
+    nr_rings_--;
+  } else {
+    free_rings_.push_back(r);
+  }
+}
+
+std::unique_ptr<ZoneIOBatch> UringEngine::Submit(ZoneIORequest *reqs,
+                                                 size_t nr_reqs) {
+  Ring *r = AcquireRing();
+  if (r == nullptr) return nullptr;
+  auto batch = std::make_unique<UringBatch>(this, r, reqs, nr_reqs);
+  batch->SubmitAll();
+  return batch;
+}
+
+UringBatch::UringBatch(UringEngine *engine, UringEngine::Ring *ring,
+                       ZoneIORequest *reqs, size_t nr_reqs)
+    : engine_(engine), ring_(ring), reqs_(reqs), nr_reqs_(nr_reqs) {
+  for (size_t i = 0; i < nr_reqs_; i++) reqs_[i].result = -EINPROGRESS;
+}
+
+UringBatch::~UringBatch() {
+  Poll(true);
+  engine_->ReleaseRing(ring_, broken_);
+}
+
+void UringBatch::Prepare(struct io_uring_sqe *sqe, ZoneIORequest *req) {
+  int slot = req->write    ? UringEngine::kWriteSlot
+             : req->direct ? UringEngine::kReadDirectSlot
+                           : UringEngine::kReadSlot;
+  int fd = ring_->fixed_files ? slot : engine_->fds_[slot];
+
+  if (req->write)
+    io_uring_prep_write(sqe, fd, req->buf, req->size, req->pos);
+  else
+    io_uring_prep_read(sqe, fd, req->buf, req->size, req->pos);
+  unsigned int flags = 0;
+  if (ring_->fixed_files) flags |= IOSQE_FIXED_FILE;
+  if (req->link && req + 1 < reqs_ + nr_reqs_) flags |= IOSQE_IO_LINK;
+  io_uring_sqe_set_flags(sqe, flags);
+  io_uring_sqe_set_data(sqe, req);
+}
+
+void UringBatch::ResumeChain() {
+  split_chain_ = false;
+  while (inflight_ > 0 && !broken_) {
+    int ret = io_uring_submit_and_wait(&ring_->ring, 1);
+    if (ret < 0 && ret != -EINTR) {
+      Fail(ret);
+      return;
+    }
+    Reap();
+  }
+  // the tail is cancelled as the kernel would have done it
+  ZoneIORequest *head = &reqs_[next_ - 1];
+  if (head->result == static_cast<int>(head->size)) return;
+  for (bool link = true; link && next_ < nr_reqs_; next_++) {
+    reqs_[next_].result = -ECANCELED;
+    link = reqs_[next_].link;
+  }
+}
+
+void UringBatch::SubmitAll() {
+  while (next_ < nr_reqs_ && !broken_) {
+    if (split_chain_) {
+      ResumeChain();
+      continue;
+    }
+    std::vector<struct io_uring_sqe *> prepared_sqes;
+    size_t prepared = 0;
+    struct io_uring_sqe *last = nullptr;
+    while (next_ + prepared < nr_reqs_ &&
+           inflight_ + prepared < engine_->depth_) {
+      struct io_uring_sqe *sqe = io_uring_get_sqe(&ring_->ring);
+      if (sqe == nullptr) break;
+      Prepare(sqe, &reqs_[next_ + prepared]);
+      prepared_sqes.push_back(sqe);
+      last = sqe;
+      prepared++;
+    }
+    // a link cannot span two submissions, the rest of the chain waits
+    if (last != nullptr && (last->flags & IOSQE_IO_LINK) &&
+        next_ + prepared < nr_reqs_) {
+      last->flags &= ~IOSQE_IO_LINK;
+      split_chain_ = true;
+    }
+
+    // ring is full, wait for a slot
+    unsigned int wait_nr = prepared == 0 ? 1 : 0;
+    int ret;
+    do {
+      ret = io_uring_submit_and_wait(&ring_->ring, wait_nr);
+    } while (ret == -EINTR);
+    if (ret < 0) {
+      // nothing was taken, the SQEs would go out with the next submission
+      for (auto sqe : prepared_sqes) {
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, nullptr);
+      }
+      Fail(ret);
+      break;
+    }
+    next_ += prepared;
+    inflight_ += prepared;
+    Reap();
+  }
+}
+
+size_t UringBatch::Poll(bool wait) {
+  Reap();
+  while (wait && inflight_ > 0) {
+    int ret = io_uring_submit_and_wait(&ring_->ring, 1);
+    if (ret < 0 && ret != -EINTR) {
+      Fail(ret);
+      break;
+    }
+    Reap();
+  }
+  return inflight_ + (nr_reqs_ - next_);
+}
+
+void UringBatch::Reap() {
+  struct io_uring_cqe *cqe;
+  while (inflight_ > 0 && io_uring_peek_cqe(&ring_->ring, &cqe) == 0) {
+    auto req = static_cast<ZoneIORequest *>(io_uring_cqe_get_data(cqe));
+    int res = cqe->res;
+    io_uring_cqe_seen(&ring_->ring, cqe);
+    // cancel requests and disarmed SQEs carry no request
+    if (req == nullptr) continue;
+    req->result = res;
+    inflight_--;
+  }
+}
+
+void UringBatch::CancelInflight() {
+  for (size_t i = 0; i < next_; i++) {
+    if (reqs_[i].result != -EINPROGRESS) continue;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&ring_->ring);
+    if (sqe == nullptr) {
+      io_uring_submit(&ring_->ring);
+      sqe = io_uring_get_sqe(&ring_->ring);
+      if (sqe == nullptr) break;
+    }
+    io_uring_prep_cancel(sqe, &reqs_[i], 0);
+    io_uring_sqe_set_data(sqe, nullptr);
+  }
+  io_uring_submit(&ring_->ring);
+  while (inflight_ > 0) {
+    struct io_uring_cqe *cqe;
+    int ret = io_uring_wait_cqe(&ring_->ring, &cqe);
+    if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) break;
+    Reap();
+  }
+}
+
+void UringBatch::Fail(int err) {
+  // the ring can no longer be trusted, it is torn down on release. The
+  // kernel may still be reading or filling the buffers of requests in
+  // flight, so those are cancelled and waited for before the caller sees
+  // the failure
+  broken_ = true;
+  for (size_t i = next_; i < nr_reqs_; i++) reqs_[i].result = err;
+  CancelInflight();
+  next_ = nr_reqs_;
+  // only left if the ring refuses even to be waited on
+  for (size_t i = 0; i < nr_reqs_; i++)
+    if (reqs_[i].result == -EINPROGRESS) reqs_[i].result = err;
+  inflight_ = 0;
+}
+
+}  // namespace aquafs
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
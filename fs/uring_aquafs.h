@@ -0,0 +1,96 @@
+#ifndef ROCKSDB_URING_AQUAFS_H
+#define ROCKSDB_URING_AQUAFS_H
+
+#include <liburing.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../base/io_status.h"
+#include "zbd_aquafs.h"
+
+namespace aquafs {
+
+class UringBatch;
+
+/*
+ * Persistent io_uring engine of one zoned block device.
+ *
+ * Every batch takes a ring from a pool for its whole lifetime, so a ring is
+ * never shared between threads and completions never need to be routed
+ * across callers. Rings are created on demand and kept until the engine is
+ * destroyed; the device fds are registered with each of them.
+ */
+class UringEngine {
+ public:
+  /* Fixed file slots, in the order the fds are registered */
+  enum FileSlot { kReadSlot = 0, kReadDirectSlot = 1, kWriteSlot = 2 };
+
+  UringEngine(unsigned int depth, int read_f, int read_direct_f, int write_f);
+  ~UringEngine();
+
+  /* Creates the first ring, fails if the kernel does not support io_uring */
+  IOStatus Open();
+
+  /* Submits a batch, returns nullptr if no ring is available */
+  std::unique_ptr<ZoneIOBatch> Submit(ZoneIORequest *reqs, size_t nr_reqs);
+
+ private:
+  friend class UringBatch;
+
+  struct Ring {
+    struct io_uring ring {};
+    bool fixed_files = false;
+  };
+
+  /* Upper bound of rings, i.e. of batches in flight at the same time */
+  static constexpr size_t kMaxRings = 64;
+
+  unsigned int depth_;
+  int fds_[3];
+  std::mutex mtx_;
+  std::vector<Ring *> free_rings_;
+  size_t nr_rings_ = 0;
+
+  Ring *NewRing();
+  void DeleteRing(Ring *r);
+  Ring *AcquireRing();
+  void ReleaseRing(Ring *r, bool broken);
+};
+
+class UringBatch : public ZoneIOBatch {
+ public:
+  UringBatch(UringEngine *engine, UringEngine::Ring *ring, ZoneIORequest *reqs,
+             size_t nr_reqs);
+  ~UringBatch() override;
+
+  size_t Poll(bool wait) override;
+
+  /* Pushes every request to the ring, waiting for room when it is full */
+  void SubmitAll();
+
+ private:
+  UringEngine *engine_;
+  UringEngine::Ring *ring_;
+  ZoneIORequest *reqs_;
+  size_t nr_reqs_;
+  size_t next_ = 0;
+  size_t inflight_ = 0;
+  bool broken_ = false;
+  /* A chain was cut at the end of the last submission */
+  bool split_chain_ = false;
+
+  void Prepare(struct io_uring_sqe *sqe, ZoneIORequest *req);
+  /* Waits for the submitted head of a cut chain before its tail is sent */
+  void ResumeChain();
+  void Reap();
+  /* Cancels the submitted requests which have not completed and waits for
+   * their completions */
+  void CancelInflight();
+  void Fail(int err);
+};
+
+}  // namespace aquafs
+
+#endif  // ROCKSDB_URING_AQUAFS_H
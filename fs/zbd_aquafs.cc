@@ -8,6 +8,7 @@
 
 #include "zbd_aquafs.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstring>
@@ -24,11 +25,15 @@
 
 #include "raid/zone_raid0.h"
 #include "raid/zone_raid1.h"
+#include "raid/zone_raid10.h"
+#include "raid/zone_raid5.h"
 #include "raid/zone_raidc.h"
 #include "raid/zone_raid.h"
 #include "raid/zone_raid_auto.h"
 #include "../base/env.h"
 #include "../base/io_status.h"
+#include "configuration.h"
+#include "io_aquafs.h"
 
 #include "snapshot.h"
 #include "zbdlib_aquafs.h"
@@ -51,6 +56,40 @@ Zone::Zone(ZonedBlockDevice *zbd, ZonedBlockDeviceBackend *zbd_be,
     capacity_ = max_capacity_ - (wp_ - start_);
 }
 
+void Zone::AddUsedCapacity(uint64_t length) {
+  std::lock_guard<std::mutex> lock(used_mtx_);
+  used_capacity_ += length;
+  zbd_->UpdateUsedSpace(this, static_cast<int64_t>(length));
+}
+
+void Zone::SubUsedCapacity(uint64_t length) {
+  std::lock_guard<std::mutex> lock(used_mtx_);
+  assert(used_capacity_ >= length);
+  used_capacity_ -= length;
+  zbd_->UpdateUsedSpace(this, -static_cast<int64_t>(length));
+}
+
+void Zone::AddLiveExtent(ZoneExtent *extent, ZoneFile *file) {
+  std::lock_guard<std::mutex> lock(live_extents_mtx_);
+  live_extents_[extent] = file;
+}
+
+void Zone::RemoveLiveExtent(ZoneExtent *extent) {
+  std::lock_guard<std::mutex> lock(live_extents_mtx_);
+  live_extents_.erase(extent);
+}
+
+void Zone::GetLiveExtents(std::vector<ZoneLiveExtent> *extents) {
+  std::lock_guard<std::mutex> lock(live_extents_mtx_);
+  extents->reserve(extents->size() + live_extents_.size());
+  for (const auto &it : live_extents_) {
+    /* A file in its destructor still waits for us to remove its extents */
+    auto file = it.second->weak_from_this().lock();
+    if (!file) continue;
+    extents->push_back({std::move(file), it.first->start_, it.first->length_});
+  }
+}
+
 bool Zone::IsUsed() { return (used_capacity_ > 0); }
 uint64_t Zone::GetCapacityLeft() const { return capacity_; }
 bool Zone::IsFull() const { return (capacity_ == 0); }
@@ -71,6 +110,7 @@ void Zone::EncodeJson(std::ostream &json_stream) {
 IOStatus Zone::Reset() {
   bool offline;
   uint64_t max_capacity;
+  uint64_t old_capacity = capacity_;
 
   assert(!IsUsed());
   assert(IsBusy());
@@ -85,6 +125,9 @@ IOStatus Zone::Reset() {
 
   wp_ = start_;
   lifetime_ = WLTH_NOT_SET;
+  predicted_death_ = 0;
+  zbd_->UpdateFreeSpace(this, old_capacity);
+  zbd_->UpdateZonePool(this);
 
   return IOStatus::OK();
 }
@@ -92,11 +135,14 @@ IOStatus Zone::Reset() {
 IOStatus Zone::Finish() {
   assert(IsBusy());
 
+  uint64_t old_capacity = capacity_;
   IOStatus ios = zbd_be_->Finish(start_);
   if (ios != IOStatus::OK()) return ios;
 
   capacity_ = 0;
   wp_ = start_ + zbd_->GetZoneSize();
+  zbd_->UpdateFreeSpace(this, old_capacity);
+  zbd_->UpdateZonePool(this);
 
   return IOStatus::OK();
 }
@@ -118,6 +164,8 @@ IOStatus Zone::Append(char *data, uint32_t size) {
   zbd_->GetMetrics()->ReportThroughput(AQUAFS_ZONE_WRITE_THROUGHPUT, size);
   char *ptr = data;
   uint32_t left = size;
+  bool was_empty = IsEmpty();
+  uint64_t old_capacity = capacity_;
   int ret;
 
   if (capacity_ < size)
@@ -128,6 +176,8 @@ IOStatus Zone::Append(char *data, uint32_t size) {
   while (left) {
     ret = zbd_be_->Write(ptr, left, wp_);
     if (ret < 0) {
+      zbd_->UpdateFreeSpace(this, old_capacity);
+      if (was_empty && !IsEmpty()) zbd_->UpdateZonePool(this);
       return IOStatus::IOError(strerror(errno));
     }
 
@@ -138,6 +188,9 @@ IOStatus Zone::Append(char *data, uint32_t size) {
     zbd_->AddBytesWritten(ret);
   }
 
+  zbd_->UpdateFreeSpace(this, old_capacity);
+  if (was_empty || IsFull()) zbd_->UpdateZonePool(this);
+
   return IOStatus::OK();
 }
 
@@ -151,10 +204,153 @@ inline IOStatus Zone::CheckRelease() {
   return IOStatus::OK();
 }
 
+namespace {
+
+/* Batch that was already executed synchronously at submission */
+class CompletedZoneIOBatch : public ZoneIOBatch {
+ public:
+  size_t Poll(bool /*wait*/) override { return 0; }
+};
+
+}  // namespace
+
+std::unique_ptr<ZoneIOBatch> ZonedBlockDeviceBackend::SubmitIO(
+    ZoneIORequest *reqs, size_t nr_reqs) {
+  bool cancel = false;
+  for (size_t i = 0; i < nr_reqs; i++) {
+    ZoneIORequest &req = reqs[i];
+    if (cancel) {
+      req.result = -ECANCELED;
+      cancel = req.link;
+      continue;
+    }
+    int r;
+    do {
+      r = req.write ? Write(req.buf, req.size, req.pos)
+                    : Read(req.buf, static_cast<int>(req.size), req.pos,
+                           req.direct);
+    } while (r < 0 && errno == EINTR);
+    req.result = r < 0 ? -errno : r;
+    cancel = req.link && req.result != static_cast<int>(req.size);
+  }
+  return std::make_unique<CompletedZoneIOBatch>();
+}
+
+void ZonedBlockDevice::AddToPoolLocked(Zone *zone) {
+  if (zone->IsEmpty()) {
+    /* Zones that went offline on reset have no capacity left to hand out */
+    zone->pool_state_ =
+        zone->capacity_ > 0 ? Zone::PoolState::kEmpty : Zone::PoolState::kNone;
+  } else if (zone->IsFull()) {
+    zone->pool_state_ = Zone::PoolState::kFull;
+  } else {
+    zone->pool_state_ = Zone::PoolState::kOpen;
+  }
+  zone->pool_lifetime_ = zone->lifetime_;
+
+  switch (zone->pool_state_) {
+    case Zone::PoolState::kEmpty:
+      empty_zones_.insert(zone);
+      break;
+    case Zone::PoolState::kOpen:
+      open_zones_[zone->pool_lifetime_].insert(zone);
+      break;
+    case Zone::PoolState::kFull:
+      full_zones_.insert(zone);
+      zone->full_time_ = time(nullptr);
+      zone->pool_max_capacity_ = zone->max_capacity_;
+      reclaimable_space_ += zone->pool_max_capacity_ - zone->used_capacity_;
+      full_max_capacity_ += zone->pool_max_capacity_;
+      break;
+    default:
+      break;
+  }
+}
+
+void ZonedBlockDevice::RemoveFromPoolLocked(Zone *zone) {
+  switch (zone->pool_state_) {
+    case Zone::PoolState::kEmpty:
+      empty_zones_.erase(zone);
+      break;
+    case Zone::PoolState::kOpen:
+      open_zones_[zone->pool_lifetime_].erase(zone);
+      break;
+    case Zone::PoolState::kFull:
+      full_zones_.erase(zone);
+      reclaimable_space_ -= zone->pool_max_capacity_ - zone->used_capacity_;
+      full_max_capacity_ -= zone->pool_max_capacity_;
+      break;
+    default:
+      break;
+  }
+  zone->pool_state_ = Zone::PoolState::kNone;
+}
+
+void ZonedBlockDevice::UpdateZonePool(Zone *zone) {
+  std::lock_guard<std::mutex> lock(zone_pools_mtx_);
+  /* Meta zones are not handed out by the allocator */
+  if (!zone->pooled_) return;
+  std::lock_guard<std::mutex> used_lock(zone->used_mtx_);
+  RemoveFromPoolLocked(zone);
+  AddToPoolLocked(zone);
+}
+
+uint64_t ZonedBlockDevice::GetFreePercent() {
+  uint64_t free = free_space_;
+  uint64_t total = free + used_space_ + reclaimable_space_;
+  return total == 0 ? 100 : (100 * free) / total;
+}
+
+void ZonedBlockDevice::RequestGC(bool urgent) {
+  {
+    std::lock_guard<std::mutex> lock(gc_request_mtx_);
+    gc_requested_ = true;
+    gc_urgent_ = gc_urgent_ || urgent;
+  }
+  gc_request_cv_.notify_one();
+}
+
+bool ZonedBlockDevice::WaitForGCRequest(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(gc_request_mtx_);
+  gc_request_cv_.wait_for(lock, timeout, [this] { return gc_requested_; });
+  bool urgent = gc_urgent_;
+  gc_requested_ = false;
+  gc_urgent_ = false;
+  return urgent;
+}
+
+void ZonedBlockDevice::GetGCZoneStats(std::vector<GCZoneStats> *zones) {
+  std::lock_guard<std::mutex> lock(zone_pools_mtx_);
+  zones->clear();
+  zones->reserve(full_zones_.size());
+  for (const auto z : full_zones_) {
+    uint64_t used = z->used_capacity_;
+    if (used == 0 || used >= z->max_capacity_) continue;
+    zones->push_back(
+        {z->start_, z->max_capacity_, used, z->full_time_, z->lifetime_});
+  }
+}
+
+void ZonedBlockDevice::UpdateFreeSpace(Zone *zone, uint64_t old_capacity) {
+  if (!zone->pooled_) return;
+  /* Wraps around modulo 2^64 when capacity shrinks */
+  free_space_ += zone->capacity_ - old_capacity;
+}
+
+void ZonedBlockDevice::UpdateUsedSpace(Zone *zone, int64_t delta) {
+  /* Caller holds zone->used_mtx_ */
+  if (!zone->pooled_) return;
+  used_space_ += delta;
+  if (zone->pool_state_ == Zone::PoolState::kFull) reclaimable_space_ -= delta;
+}
+
 Zone *ZonedBlockDevice::GetIOZone(uint64_t offset) {
-  for (const auto z : io_zones)
-    if (z->start_ <= offset && offset < (z->start_ + zbd_be_->GetZoneSize()))
-      return z;
+  uint64_t nr = offset / zbd_be_->GetZoneSize();
+  if (nr >= io_zone_table_.size()) return nullptr;
+
+  Zone *z = io_zone_table_[nr];
+  if (z && z->start_ <= offset && offset < (z->start_ + zbd_be_->GetZoneSize()))
+    return z;
   return nullptr;
 }
 
@@ -205,6 +401,15 @@ ZonedBlockDevice::ZonedBlockDevice(std::string path, ZbdBackendType backend,
           zbd_be_ = std::make_unique<Raid1ZonedBlockDevice>(
               logger_, std::move(raid_devices));
           break;
+        case RaidMode::RAID5:
+        case RaidMode::RAID6:
+          zbd_be_ = std::make_unique<Raid5ZonedBlockDevice>(
+              logger_, mode, std::move(raid_devices));
+          break;
+        case RaidMode::RAID10:
+          zbd_be_ = std::make_unique<Raid10ZonedBlockDevice>(
+              logger_, std::move(raid_devices));
+          break;
         case RaidMode::RAID_C:
           zbd_be_ = std::make_unique<RaidCZonedBlockDevice>(
               logger_, std::move(raid_devices));
@@ -240,10 +445,24 @@ IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
   if (!readonly && !exclusive)
     return IOStatus::InvalidArgument("Write opens must be exclusive");
 
+  /* Before the backend opens, RAID backends stage recovery I/O through it */
+  const size_t page_sz = sysconf(_SC_PAGESIZE);
+  buffer_pool_ =
+      std::make_unique<IOBufferPool>(page_sz, FLAGS_io_buffer_hugepage);
+  zbd_be_->buffer_pool_ = buffer_pool_.get();
+
   IOStatus ios = zbd_be_->Open(readonly, exclusive, &max_nr_active_zones,
                                &max_nr_open_zones);
   if (ios != IOStatus::OK()) return ios;
 
+  if (zbd_be_->GetBlockSize() > page_sz) {
+    /* Blocks larger than a page need larger alignment; nothing holds a
+     * buffer of the pool once Open has returned */
+    buffer_pool_ = std::make_unique<IOBufferPool>(zbd_be_->GetBlockSize(),
+                                                  FLAGS_io_buffer_hugepage);
+    zbd_be_->buffer_pool_ = buffer_pool_.get();
+  }
+
   if (zbd_be_->GetNrZones() < AQUAFS_MIN_ZONES) {
     return IOStatus::NotSupported(
         "To few zones on zoned backend (" + std::to_string(AQUAFS_MIN_ZONES) +
@@ -310,50 +529,48 @@ IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
     }
   }
 
+  /* Index io zones by zone number, RAID backends report starts in units of
+   * their (multiplied) logical zone size */
+  io_zone_table_.assign(zbd_be_->GetNrZones(), nullptr);
+  for (const auto z : io_zones) {
+    uint64_t nr = z->start_ / zbd_be_->GetZoneSize();
+    if (nr >= io_zone_table_.size()) io_zone_table_.resize(nr + 1, nullptr);
+    if (io_zone_table_[nr] == nullptr) io_zone_table_[nr] = z;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(zone_pools_mtx_);
+    for (const auto z : io_zones) {
+      std::lock_guard<std::mutex> used_lock(z->used_mtx_);
+      z->pooled_ = true;
+      AddToPoolLocked(z);
+      free_space_ += z->capacity_;
+      used_space_ += z->used_capacity_;
+    }
+  }
+
   start_time_ = time(NULL);
 
   return IOStatus::OK();
 }
 
-uint64_t ZonedBlockDevice::GetFreeSpace() {
-  uint64_t free = 0;
-  for (const auto z : io_zones) {
-    free += z->capacity_;
-  }
-  return free;
-}
+uint64_t ZonedBlockDevice::GetFreeSpace() { return free_space_.load(); }
 
-uint64_t ZonedBlockDevice::GetUsedSpace() {
-  uint64_t used = 0;
-  for (const auto z : io_zones) {
-    used += z->used_capacity_;
-  }
-  return used;
-}
+uint64_t ZonedBlockDevice::GetUsedSpace() { return used_space_.load(); }
 
 uint64_t ZonedBlockDevice::GetReclaimableSpace() {
-  uint64_t reclaimable = 0;
-  for (const auto z : io_zones) {
-    if (z->IsFull()) reclaimable += (z->max_capacity_ - z->used_capacity_);
-  }
-  return reclaimable;
+  return reclaimable_space_.load();
 }
 
 void ZonedBlockDevice::LogZoneStats() {
-  uint64_t used_capacity = 0;
-  uint64_t reclaimable_capacity = 0;
-  uint64_t reclaimables_max_capacity = 0;
+  uint64_t used_capacity = used_space_.load();
+  uint64_t reclaimable_capacity = reclaimable_space_.load();
+  uint64_t reclaimables_max_capacity = full_max_capacity_.load();
   uint64_t active = 0;
 
-  for (const auto z : io_zones) {
-    used_capacity += z->used_capacity_;
-
-    if (z->used_capacity_) {
-      reclaimable_capacity += z->max_capacity_ - z->used_capacity_;
-      reclaimables_max_capacity += z->max_capacity_;
-    }
-
-    if (!(z->IsFull() || z->IsEmpty())) active++;
+  {
+    std::lock_guard<std::mutex> lock(zone_pools_mtx_);
+    for (const auto &pool : open_zones_) active += pool.size();
   }
 
   if (reclaimables_max_capacity == 0) reclaimables_max_capacity = 1;
@@ -483,8 +700,43 @@ IOStatus ZonedBlockDevice::AllocateMetaZone(Zone **out_meta_zone) {
   return IOStatus::NoSpace("Out of metadata zones");
 }
 
-IOStatus ZonedBlockDevice::ResetUnusedIOZones() {
+IOStatus ZonedBlockDevice::RefreshZoneStates() {
+  std::unique_ptr<ZoneList> zone_rep = zbd_be_->ListZones();
+  if (zone_rep == nullptr || zone_rep->ZoneCount() != zbd_be_->GetNrZones()) {
+    Error(logger_, "Failed to list zones");
+    return IOStatus::IOError("Failed to list zones");
+  }
+
+  active_io_zones_ = 0;
   for (const auto z : io_zones) {
+    unsigned int idx = z->start_ / zbd_be_->GetZoneSize();
+    uint64_t old_capacity = z->capacity_;
+    z->max_capacity_ = zbd_be_->ZoneMaxCapacity(zone_rep, idx);
+    z->wp_ = zbd_be_->ZoneWp(zone_rep, idx);
+    z->capacity_ = 0;
+    if (zbd_be_->ZoneIsWritable(zone_rep, idx))
+      z->capacity_ = z->max_capacity_ - (z->wp_ - z->start_);
+    if (zbd_be_->ZoneIsActive(zone_rep, idx)) active_io_zones_++;
+    UpdateFreeSpace(z, old_capacity);
+    UpdateZonePool(z);
+  }
+
+  return IOStatus::OK();
+}
+
+IOStatus ZonedBlockDevice::ResetUnusedIOZones() {
+  std::vector<Zone *> unused;
+  {
+    std::lock_guard<std::mutex> lock(zone_pools_mtx_);
+    for (const auto &pool : open_zones_)
+      for (const auto z : pool)
+        if (!z->IsUsed()) unused.push_back(z);
+    for (const auto z : full_zones_)
+      if (!z->IsUsed()) unused.push_back(z);
+  }
+
+  /* Reset moves the zone to the empty pool, so it runs without the lock */
+  for (const auto z : unused) {
     if (z->Acquire()) {
       if (!z->IsEmpty() && !z->IsUsed()) {
         bool full = z->IsFull();
@@ -561,26 +813,38 @@ IOStatus ZonedBlockDevice::ApplyFinishThreshold() {
 
   if (finish_threshold_ == 0) return IOStatus::OK();
 
-  for (const auto z : io_zones) {
-    if (z->Acquire()) {
-      bool within_finish_threshold =
-          z->capacity_ < (z->max_capacity_ * finish_threshold_ / 100);
-      if (!(z->IsEmpty() || z->IsFull()) && within_finish_threshold) {
-        /* If there is less than finish_threshold_% remaining capacity in a
-         * non-open-zone, finish the zone */
-        s = z->Finish();
-        if (!s.ok()) {
-          z->Release();
-          Debug(logger_, "Failed finishing zone");
-          return s;
-        }
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
-        PutActiveIOZoneToken();
-      } else {
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
+  std::vector<Zone *> victims;
+  {
+    std::lock_guard<std::mutex> lock(zone_pools_mtx_);
+    for (const auto &pool : open_zones_) {
+      for (const auto z : pool) {
+        bool within_finish_threshold =
+            z->capacity_ < (z->max_capacity_ * finish_threshold_ / 100);
+        if (within_finish_threshold && z->Acquire()) victims.push_back(z);
+      }
+    }
+  }
+
+  /* Finish moves the zone to the full pool, so it runs without the lock */
+  for (size_t i = 0; i < victims.size(); i++) {
+    Zone *z = victims[i];
+    bool within_finish_threshold =
+        z->capacity_ < (z->max_capacity_ * finish_threshold_ / 100);
+    if (!(z->IsEmpty() || z->IsFull()) && within_finish_threshold) {
+      /* If there is less than finish_threshold_% remaining capacity in a
+       * non-open-zone, finish the zone */
+      s = z->Finish();
+      if (!s.ok()) {
+        for (size_t j = i; j < victims.size(); j++) victims[j]->Release();
+        Debug(logger_, "Failed finishing zone");
+        return s;
       }
+      s = z->CheckRelease();
+      if (!s.ok()) return s;
+      PutActiveIOZoneToken();
+    } else {
+      s = z->CheckRelease();
+      if (!s.ok()) return s;
     }
   }
 
@@ -591,24 +855,25 @@ IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
   IOStatus s;
   Zone *finish_victim = nullptr;
 
-  for (const auto z : io_zones) {
-    if (z->Acquire()) {
-      if (z->IsEmpty() || z->IsFull()) {
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
-        continue;
-      }
-      if (finish_victim == nullptr) {
-        finish_victim = z;
-        continue;
-      }
-      if (finish_victim->capacity_ > z->capacity_) {
-        s = finish_victim->CheckRelease();
-        if (!s.ok()) return s;
+  {
+    std::lock_guard<std::mutex> lock(zone_pools_mtx_);
+    for (const auto &pool : open_zones_) {
+      for (const auto z : pool) {
+        /* Only acquire zones that would beat the current victim */
+        if (finish_victim != nullptr &&
+            finish_victim->capacity_ <= z->capacity_)
+          continue;
+        if (!z->Acquire()) continue;
+        if (z->IsEmpty() || z->IsFull()) {
+          s = z->CheckRelease();
+          if (!s.ok()) return s;
+          continue;
+        }
+        if (finish_victim != nullptr) {
+          s = finish_victim->CheckRelease();
+          if (!s.ok()) return s;
+        }
         finish_victim = z;
-      } else {
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
       }
     }
   }
@@ -626,6 +891,9 @@ IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
     PutActiveIOZoneToken();
   }
 
+  /* Finishing zones to make room is a sign of space pressure */
+  RequestGC(false);
+
   if (!release_status.ok()) {
     return release_status;
   }
@@ -633,37 +901,81 @@ IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
   return s;
 }
 
+IOStatus ZonedBlockDevice::GetDeathMatch(time_t predicted_death,
+                                         Zone **zone_out,
+                                         uint32_t min_capacity) {
+  IOStatus s;
+  time_t now = time(nullptr);
+  time_t tolerance = std::max<time_t>(
+      (predicted_death - now) * FLAGS_lifetime_tolerance / 100, 1);
+
+  std::vector<std::pair<time_t, Zone *>> matches;
+  std::lock_guard<std::mutex> lock(zone_pools_mtx_);
+  for (const auto &pool : open_zones_) {
+    for (const auto z : pool) {
+      time_t zone_death = z->predicted_death_;
+      if (zone_death == 0) continue;
+      time_t diff = std::abs(zone_death - predicted_death);
+      if (diff <= tolerance) matches.emplace_back(diff, z);
+    }
+  }
+  std::sort(matches.begin(), matches.end(),
+            [](const auto &a, const auto &b) { return a.first < b.first; });
+
+  *zone_out = nullptr;
+  for (const auto &m : matches) {
+    Zone *z = m.second;
+    if (!z->Acquire()) continue;
+    if ((z->used_capacity_ > 0) && !z->IsFull() &&
+        z->capacity_ >= min_capacity) {
+      *zone_out = z;
+      break;
+    }
+    s = z->CheckRelease();
+    if (!s.ok()) return s;
+  }
+  return IOStatus::OK();
+}
+
 IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(
     WriteLifeTimeHint file_lifetime, unsigned int *best_diff_out,
-    Zone **zone_out, uint32_t min_capacity) {
+    Zone **zone_out, uint32_t min_capacity, time_t predicted_death) {
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
   Zone *allocated_zone = nullptr;
   IOStatus s;
 
-  for (const auto z : io_zones) {
-    if (z->Acquire()) {
+  /* Files expected to die together share zones, regardless of the hint */
+  if (predicted_death != 0) {
+    s = GetDeathMatch(predicted_death, &allocated_zone, min_capacity);
+    if (!s.ok()) return s;
+    if (allocated_zone != nullptr) {
+      *best_diff_out = 0;
+      *zone_out = allocated_zone;
+      return IOStatus::OK();
+    }
+  }
+
+  /* Visit the open zone pools from the best lifetime match to the worst */
+  std::vector<std::pair<unsigned int, int>> order;
+  for (int lt = WLTH_NOT_SET; lt <= WLTH_EXTREME; lt++)
+    order.emplace_back(
+        GetLifeTimeDiff(static_cast<WriteLifeTimeHint>(lt), file_lifetime), lt);
+  std::stable_sort(order.begin(), order.end());
+
+  std::lock_guard<std::mutex> lock(zone_pools_mtx_);
+  for (const auto &o : order) {
+    if (o.first > best_diff || allocated_zone != nullptr) break;
+    for (const auto z : open_zones_[o.second]) {
+      if (z->used_capacity_ == 0 || z->capacity_ < min_capacity) continue;
+      if (!z->Acquire()) continue;
       if ((z->used_capacity_ > 0) && !z->IsFull() &&
           z->capacity_ >= min_capacity) {
-        unsigned int diff = GetLifeTimeDiff(z->lifetime_, file_lifetime);
-        if (diff <= best_diff) {
-          if (allocated_zone != nullptr) {
-            s = allocated_zone->CheckRelease();
-            if (!s.ok()) {
-              IOStatus s_ = z->CheckRelease();
-              if (!s_.ok()) return s_;
-              return s;
-            }
-          }
-          allocated_zone = z;
-          best_diff = diff;
-        } else {
-          s = z->CheckRelease();
-          if (!s.ok()) return s;
-        }
-      } else {
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
+        allocated_zone = z;
+        best_diff = o.first;
+        break;
       }
+      s = z->CheckRelease();
+      if (!s.ok()) return s;
     }
   }
 
@@ -676,18 +988,28 @@ IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(
 IOStatus ZonedBlockDevice::AllocateEmptyZone(Zone **zone_out) {
   IOStatus s;
   Zone *allocated_zone = nullptr;
-  for (const auto z : io_zones) {
-    if (z->Acquire()) {
-      if (z->IsEmpty()) {
-        allocated_zone = z;
-        break;
-      } else {
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
+  {
+    std::lock_guard<std::mutex> lock(zone_pools_mtx_);
+    for (const auto z : empty_zones_) {
+      if (z->Acquire()) {
+        if (z->IsEmpty()) {
+          allocated_zone = z;
+          break;
+        } else {
+          s = z->CheckRelease();
+          if (!s.ok()) return s;
+        }
       }
     }
   }
   *zone_out = allocated_zone;
+
+  /* Free space watermark, checked on every new zone */
+  if (allocated_zone == nullptr)
+    RequestGC(true);
+  else if (GetFreePercent() <= FLAGS_gc_start_level)
+    RequestGC(false);
+
   return IOStatus::OK();
 }
 
@@ -725,13 +1047,14 @@ int ZonedBlockDevice::Read(char *buf, uint64_t offset, int n, bool direct) {
 
 IOStatus ZonedBlockDevice::ReleaseMigrateZone(Zone *zone) {
   IOStatus s = IOStatus::OK();
+  /* A failed TakeMigrateZone has already given its slot back */
+  if (zone == nullptr) return s;
   {
     std::unique_lock<std::mutex> lock(migrate_zone_mtx_);
-    migrating_ = false;
-    if (zone != nullptr) {
-      s = zone->CheckRelease();
-      Info(logger_, "ReleaseMigrateZone: %lu", zone->start_);
-    }
+    assert(nr_migrating_ > 0);
+    nr_migrating_--;
+    s = zone->CheckRelease();
+    Info(logger_, "ReleaseMigrateZone: %lu", zone->start_);
   }
   migrate_resource_.notify_one();
   return s;
@@ -741,24 +1064,31 @@ IOStatus ZonedBlockDevice::TakeMigrateZone(Zone **out_zone,
                                            WriteLifeTimeHint file_lifetime,
                                            uint32_t min_capacity) {
   std::unique_lock<std::mutex> lock(migrate_zone_mtx_);
-  migrate_resource_.wait(lock, [this] { return !migrating_; });
+  unsigned int max_migrating = std::max(FLAGS_gc_threads, 1u);
+  migrate_resource_.wait(
+      lock, [&] { return nr_migrating_ < max_migrating; });
 
-  migrating_ = true;
+  nr_migrating_++;
 
+  /* Concurrent migrations end up in different zones, as the match is
+   * acquired before it is returned */
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
   auto s =
       GetBestOpenZoneMatch(file_lifetime, &best_diff, out_zone, min_capacity);
   if (s.ok() && (*out_zone) != nullptr) {
     Info(logger_, "TakeMigrateZone: %lu", (*out_zone)->start_);
   } else {
-    migrating_ = false;
+    nr_migrating_--;
+    lock.unlock();
+    migrate_resource_.notify_one();
   }
 
   return s;
 }
 
 IOStatus ZonedBlockDevice::AllocateIOZone(WriteLifeTimeHint file_lifetime,
-                                          IOType io_type, Zone **out_zone) {
+                                          IOType io_type, Zone **out_zone,
+                                          time_t predicted_death) {
   Zone *allocated_zone = nullptr;
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
   int new_zone = 0;
@@ -793,7 +1123,8 @@ IOStatus ZonedBlockDevice::AllocateIOZone(WriteLifeTimeHint file_lifetime,
   WaitForOpenIOZoneToken(io_type == IOType::kWAL);
 
   /* Try to fill an already open zone(with the best life time diff) */
-  s = GetBestOpenZoneMatch(file_lifetime, &best_diff, &allocated_zone);
+  s = GetBestOpenZoneMatch(file_lifetime, &best_diff, &allocated_zone, 0,
+                           predicted_death);
   if (!s.ok()) {
     PutOpenIOZoneToken();
     return s;
@@ -845,6 +1176,7 @@ IOStatus ZonedBlockDevice::AllocateIOZone(WriteLifeTimeHint file_lifetime,
       if (allocated_zone != nullptr) {
         assert(allocated_zone->IsBusy());
         allocated_zone->lifetime_ = file_lifetime;
+        allocated_zone->predicted_death_ = predicted_death;
         new_zone = true;
       } else {
         PutActiveIOZoneToken();
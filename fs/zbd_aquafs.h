@@ -18,12 +18,17 @@
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 
+#include "buffer_pool_aquafs.h"
+#include "gc_policy_aquafs.h"
+#include "lifetime_aquafs.h"
 #include "metrics.h"
 #include "../base/env.h"
 #include "../base/file_system.h"
@@ -57,6 +62,15 @@ class ZonedBlockDevice;
 class ZonedBlockDeviceBackend;
 class ZoneSnapshot;
 class AquaFSSnapshotOptions;
+class ZoneFile;
+class ZoneExtent;
+
+/* A live extent stored in a zone and the file it belongs to */
+struct ZoneLiveExtent {
+  std::shared_ptr<ZoneFile> file;
+  uint64_t start;
+  uint64_t length;
+};
 
 class ZoneList {
  private:
@@ -72,10 +86,31 @@ class ZoneList {
 };
 
 class Zone {
+  friend class ZonedBlockDevice;
+
+  /* Allocator pool a zone is kept in, see ZonedBlockDevice::UpdateZonePool */
+  enum class PoolState { kNone, kEmpty, kOpen, kFull };
+
   ZonedBlockDevice *zbd_;
   ZonedBlockDeviceBackend *zbd_be_;
   std::atomic_bool busy_;
 
+  /* Guarded by ZonedBlockDevice::zone_pools_mtx_ and used_mtx_ */
+  bool pooled_ = false;
+  PoolState pool_state_ = PoolState::kNone;
+  WriteLifeTimeHint pool_lifetime_ = WLTH_NOT_SET;
+  uint64_t pool_max_capacity_ = 0;
+  /* When the zone entered the full pool, for GC victim selection */
+  time_t full_time_ = 0;
+
+  /* Orders used_capacity_ changes against pool transitions, so the
+   * reclaimable space of full zones is accounted exactly once */
+  std::mutex used_mtx_;
+
+  /* Reverse index of the extents stored in this zone, kept by ZoneFile */
+  std::mutex live_extents_mtx_;
+  std::unordered_map<ZoneExtent *, ZoneFile *> live_extents_;
+
  public:
   explicit Zone(ZonedBlockDevice *zbd, ZonedBlockDeviceBackend *zbd_be,
                 std::unique_ptr<ZoneList> &zones, unsigned int idx);
@@ -85,6 +120,8 @@ class Zone {
   uint64_t max_capacity_;
   uint64_t wp_;
   WriteLifeTimeHint lifetime_;
+  /* Predicted deletion time of the data placed here, 0 if unknown */
+  std::atomic<time_t> predicted_death_{0};
   std::atomic<uint64_t> used_capacity_;
 
   IOStatus Reset();
@@ -92,6 +129,12 @@ class Zone {
   IOStatus Close();
 
   IOStatus Append(char *data, uint32_t size);
+  void AddUsedCapacity(uint64_t length);
+  void SubUsedCapacity(uint64_t length);
+  void AddLiveExtent(ZoneExtent *extent, ZoneFile *file);
+  void RemoveLiveExtent(ZoneExtent *extent);
+  /* Files being destroyed are left out */
+  void GetLiveExtents(std::vector<ZoneLiveExtent> *extents);
   bool IsUsed();
   bool IsFull() const;
   bool IsEmpty() const;
@@ -114,11 +157,39 @@ class Zone {
   inline IOStatus CheckRelease();
 };
 
+/* One request of a batch handed to ZonedBlockDeviceBackend::SubmitIO */
+struct ZoneIORequest {
+  char *buf = nullptr;
+  uint32_t size = 0;
+  uint64_t pos = 0;
+  bool write = false;
+  bool direct = false;
+  /* Start the next request of the batch only once this one has completed
+   * in full, the next one fails with -ECANCELED otherwise. Keeps writes to
+   * a zone in order. */
+  bool link = false;
+  /* Bytes transferred, or -errno, once the request has completed */
+  int result = 0;
+};
+
+/* Handle of a batch of requests in flight on a backend. The request array
+ * passed to SubmitIO must stay valid until the batch is destroyed, which
+ * waits for every outstanding request. */
+class ZoneIOBatch {
+ public:
+  virtual ~ZoneIOBatch() = default;
+  /* Reap completed requests, waiting for all of them if wait is set.
+   * Returns the number of requests still in flight. */
+  virtual size_t Poll(bool wait) = 0;
+};
+
 class ZonedBlockDeviceBackend {
  public:
   uint32_t block_sz_ = 0;
   uint64_t zone_sz_ = 0;
   uint32_t nr_zones_ = 0;
+  /* Owned by the ZonedBlockDevice, set before the backend is opened */
+  IOBufferPool *buffer_pool_ = nullptr;
 
  public:
   virtual IOStatus Open(bool readonly, bool exclusive,
@@ -133,6 +204,10 @@ class ZonedBlockDeviceBackend {
   virtual int Read(char *buf, int size, uint64_t pos, bool direct) = 0;
   virtual int Write(char *data, uint32_t size, uint64_t pos) = 0;
   virtual int InvalidateCache(uint64_t pos, uint64_t size) = 0;
+  /* Submit a batch of reads and writes without waiting for them. Backends
+   * without an asynchronous engine complete the batch before returning. */
+  virtual std::unique_ptr<ZoneIOBatch> SubmitIO(ZoneIORequest *reqs,
+                                                size_t nr_reqs);
   virtual bool ZoneIsSwr(std::unique_ptr<ZoneList> &zones,
                          unsigned int idx) = 0;
   virtual bool ZoneIsOffline(std::unique_ptr<ZoneList> &zones,
@@ -173,11 +248,21 @@ class ZonedBlockDeviceBackend {
 
 enum class ZbdBackendType { kBlockDev, kZoneFS, kRaid };
 
+struct ZoneStartLess {
+  bool operator()(const Zone *a, const Zone *b) const {
+    return a->start_ < b->start_;
+  }
+};
+
+using ZonePool = std::set<Zone *, ZoneStartLess>;
+
 class ZonedBlockDevice {
  private:
   std::unique_ptr<ZonedBlockDeviceBackend> zbd_be_;
   std::vector<Zone *> io_zones;
   std::vector<Zone *> meta_zones;
+  /* io_zones indexed by zone number, nullptr for meta and unused zones */
+  std::vector<Zone *> io_zone_table_;
   time_t start_time_{};
   std::shared_ptr<Logger> logger_;
   uint32_t finish_threshold_ = 0;
@@ -193,15 +278,40 @@ class ZonedBlockDevice {
   std::mutex zone_deferred_status_mutex_;
   IOStatus zone_deferred_status_;
 
+  /* Allocator pools of io zones by state, zones move between them in
+   * UpdateZonePool. Open zones are further split by lifetime hint. */
+  std::mutex zone_pools_mtx_;
+  ZonePool empty_zones_;
+  ZonePool open_zones_[WLTH_EXTREME + 1];
+  ZonePool full_zones_;
+
+  /* Space counters of io zones, kept up to date by zone state transitions
+   * instead of scanning io_zones */
+  std::atomic<uint64_t> free_space_{0};
+  std::atomic<uint64_t> used_space_{0};
+  std::atomic<uint64_t> reclaimable_space_{0};
+  std::atomic<uint64_t> full_max_capacity_{0};
+
   std::condition_variable migrate_resource_;
   std::mutex migrate_zone_mtx_;
-  std::atomic<bool> migrating_{false};
+  /* Migrate zones taken, bounded by FLAGS_gc_threads */
+  unsigned int nr_migrating_ = 0;
+
+  /* Wakes the GC worker up when the allocator runs low on space */
+  std::mutex gc_request_mtx_;
+  std::condition_variable gc_request_cv_;
+  bool gc_requested_ = false;
+  bool gc_urgent_ = false;
 
   unsigned int max_nr_active_io_zones_{};
   unsigned int max_nr_open_io_zones_{};
 
   std::shared_ptr<AquaFSMetrics> metrics_;
 
+  std::unique_ptr<IOBufferPool> buffer_pool_;
+
+  LifetimePredictor lifetime_predictor_;
+
   void EncodeJsonZone(std::ostream &json_stream,
                       const std::vector<Zone *> zones);
 
@@ -216,8 +326,22 @@ class ZonedBlockDevice {
 
   Zone *GetIOZone(uint64_t offset);
 
+  /* Called by Zone after a transition between empty, open and full */
+  void UpdateZonePool(Zone *zone);
+  /* Free space percent of io zones, as seen by GC */
+  uint64_t GetFreePercent();
+  /* Signals GC, urgent when the allocator is out of empty zones */
+  void RequestGC(bool urgent);
+  /* Waits for a GC request or the timeout, returns true if it was urgent */
+  bool WaitForGCRequest(std::chrono::milliseconds timeout);
+  /* GC candidates: full zones holding both live data and garbage */
+  void GetGCZoneStats(std::vector<GCZoneStats> *zones);
+  /* Called by Zone when its capacity_ or used_capacity_ changed */
+  void UpdateFreeSpace(Zone *zone, uint64_t old_capacity);
+  void UpdateUsedSpace(Zone *zone, int64_t delta);
+
   IOStatus AllocateIOZone(WriteLifeTimeHint file_lifetime, IOType io_type,
-                          Zone **out_zone);
+                          Zone **out_zone, time_t predicted_death = 0);
   IOStatus AllocateMetaZone(Zone **out_meta_zone);
 
   uint64_t GetFreeSpace();
@@ -228,6 +352,9 @@ class ZonedBlockDevice {
   uint32_t GetBlockSize();
 
   IOStatus ResetUnusedIOZones();
+  /* Re-reads write pointers and capacities of the idle io zones, after the
+   * backend layout changed under them while recovering metadata */
+  IOStatus RefreshZoneStates();
   void LogZoneStats();
   void LogZoneUsage();
   void LogGarbageInfo();
@@ -247,9 +374,16 @@ class ZonedBlockDevice {
 
   std::shared_ptr<AquaFSMetrics> GetMetrics() { return metrics_; }
 
+  IOBufferPool *GetBufferPool() { return buffer_pool_.get(); }
+
+  LifetimePredictor *GetLifetimePredictor() { return &lifetime_predictor_; }
+
   void GetZoneSnapshot(std::vector<ZoneSnapshot> &snapshot);
 
   int Read(char *buf, uint64_t offset, int n, bool direct);
+  std::unique_ptr<ZoneIOBatch> SubmitIO(ZoneIORequest *reqs, size_t nr_reqs) {
+    return zbd_be_->SubmitIO(reqs, nr_reqs);
+  }
   IOStatus InvalidateCache(uint64_t pos, uint64_t size);
 
   IOStatus ReleaseMigrateZone(Zone *zone);
@@ -271,6 +405,10 @@ class ZonedBlockDevice {
   }
 
  private:
+  /* Must hold zone_pools_mtx_ */
+  void AddToPoolLocked(Zone *zone);
+  void RemoveFromPoolLocked(Zone *zone);
+
   IOStatus GetZoneDeferredStatus();
   bool GetActiveIOZoneTokenIfAvailable();
   void WaitForOpenIOZoneToken(bool prioritized);
@@ -278,7 +416,11 @@ class ZonedBlockDevice {
   IOStatus FinishCheapestIOZone();
   IOStatus GetBestOpenZoneMatch(WriteLifeTimeHint file_lifetime,
                                 unsigned int *best_diff_out, Zone **zone_out,
-                                uint32_t min_capacity = 0);
+                                uint32_t min_capacity = 0,
+                                time_t predicted_death = 0);
+  /* Open zone whose predicted death is within tolerance of the file's */
+  IOStatus GetDeathMatch(time_t predicted_death, Zone **zone_out,
+                         uint32_t min_capacity);
   IOStatus AllocateEmptyZone(Zone **zone_out);
 };
 
@@ -21,6 +21,7 @@
 #include "../base/env.h"
 #include "../base/io_status.h"
 #include "aquafs_utils.h"
+#include "configuration.h"
 
 namespace aquafs {
 
@@ -102,6 +103,13 @@ IOStatus ZbdlibBackend::Open(bool readonly, bool exclusive,
   IOStatus ios = CheckScheduler();
   if (ios != IOStatus::OK()) return ios;
 
+  // batched I/O falls back to pread/pwrite when io_uring is unavailable
+  if (FLAGS_uring_depth > 0) {
+    uring_ = std::make_unique<UringEngine>(FLAGS_uring_depth, read_f_,
+                                           read_direct_f_, write_f_);
+    if (!uring_->Open().ok()) uring_.reset();
+  }
+
   block_sz_ = info.pblock_size;
   zone_sz_ = info.zone_size;
   nr_zones_ = info.nr_zones;
@@ -217,6 +225,26 @@ int ZbdlibBackend::Write(char *data, uint32_t size, uint64_t pos) {
   return pwrite(write_f_, data, size, pos);
 }
 
+std::unique_ptr<ZoneIOBatch> ZbdlibBackend::SubmitIO(ZoneIORequest *reqs,
+                                                    size_t nr_reqs) {
+  std::unique_ptr<ZoneIOBatch> batch;
+#ifndef AQUAFS_DETECT_READ_OFFLINE
+  if (uring_ != nullptr) {
+#ifdef AQUAFS_SIM_DELAY
+    // requests of a batch are served concurrently
+    uint32_t max_size = 0;
+    for (size_t i = 0; i < nr_reqs; i++)
+      max_size = std::max(max_size, reqs[i].size);
+    delay_us(calculate_delay_us(max_size));
+#endif
+    batch = uring_->Submit(reqs, nr_reqs);
+  }
+#endif
+  if (batch == nullptr)
+    batch = ZonedBlockDeviceBackend::SubmitIO(reqs, nr_reqs);
+  return batch;
+}
+
 }  // namespace aquafs
 
 #endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -12,6 +12,7 @@
 
 #include "../base/io_status.h"
 
+#include "uring_aquafs.h"
 #include "zbd_aquafs.h"
 
 namespace aquafs {
@@ -23,10 +24,12 @@ public:
   int read_f_;
   int read_direct_f_;
   int write_f_;
+  std::unique_ptr<UringEngine> uring_;
 
  public:
   explicit ZbdlibBackend(std::string bdevname);
   ~ZbdlibBackend() {
+    uring_.reset();
     zbd_close(read_f_);
     zbd_close(read_direct_f_);
     zbd_close(write_f_);
@@ -41,6 +44,8 @@ public:
   int Read(char *buf, int size, uint64_t pos, bool direct);
   int Write(char *data, uint32_t size, uint64_t pos);
   int InvalidateCache(uint64_t pos, uint64_t size);
+  std::unique_ptr<ZoneIOBatch> SubmitIO(ZoneIORequest *reqs,
+                                        size_t nr_reqs) override;
 
   bool ZoneIsSwr(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
     struct zbd_zone *z = &((struct zbd_zone *)zones->GetData())[idx];
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "base/coding.h"
+#include "fs/io_aquafs.h"
+#include "fs/snapshot.h"
+#include "fs/tools/tools.h"
+
+using namespace aquafs;
+
+// tags of the ZoneFile metadata encoding, see io_aquafs.cc
+static const uint32_t kFileID = 1;
+static const uint32_t kFileSize = 3;
+static const uint32_t kExtent = 5;
+
+// ZoneFile::GetExtent cost per call for a file made of nr_extents extents
+double bench_extent_lookup(ZonedBlockDevice *zbd, uint64_t zone_start,
+                           uint64_t zone_cap, uint32_t nr_extents,
+                           uint32_t lookups) {
+  const uint64_t extent_len = zbd->GetBlockSize();
+  std::string record;
+  PutFixed32(&record, kFileID);
+  PutFixed64(&record, 1);
+  PutFixed32(&record, kFileSize);
+  PutFixed64(&record, extent_len * nr_extents);
+  for (uint32_t i = 0; i < nr_extents; i++) {
+    std::string extent;
+    PutFixed64(&extent, zone_start + (i * extent_len) % zone_cap);
+    PutFixed64(&extent, extent_len);
+    PutFixed32(&record, kExtent);
+    PutLengthPrefixedSlice(&record, Slice(extent));
+  }
+
+  ZoneFile file(zbd, 1, nullptr);
+  Slice input(record);
+  Status s = file.DecodeFrom(&input);
+  if (!s.ok()) {
+    fprintf(stderr, "failed to decode %u extents: %s\n", nr_extents,
+            s.ToString().c_str());
+    exit(1);
+  }
+
+  std::mt19937_64 rng(nr_extents);
+  std::vector<uint64_t> offsets(lookups);
+  for (auto &o : offsets) o = rng() % (extent_len * nr_extents);
+
+  uint64_t dev_offset, sum = 0;
+  auto begin = std::chrono::steady_clock::now();
+  for (auto o : offsets) {
+    file.GetExtent(o, &dev_offset);
+    sum += dev_offset;
+  }
+  auto end = std::chrono::steady_clock::now();
+  // keep the lookups from being optimized away
+  if (sum == 0) printf("\n");
+  return std::chrono::duration<double, std::nano>(end - begin).count() /
+         lookups;
+}
+
+int main() {
+  prepare_test_env(1);
+  auto zbd = std::make_unique<ZonedBlockDevice>(
+      "nullb0", ZbdBackendType::kBlockDev, nullptr);
+  auto open_status = zbd->Open(true, false);
+  if (!open_status.ok()) {
+    fprintf(stderr, "failed to open nullb0: %s\n",
+            open_status.ToString().c_str());
+    return 1;
+  }
+
+  std::vector<ZoneSnapshot> zones;
+  zbd->GetZoneSnapshot(zones);
+  if (zones.empty()) {
+    fprintf(stderr, "nullb0 has no zones\n");
+    return 1;
+  }
+
+  printf("extents,\tns/lookup\n");
+  for (uint32_t nr_extents = 16; nr_extents <= (1 << 16); nr_extents <<= 2) {
+    double ns = bench_extent_lookup(zbd.get(), zones[0].start,
+                                    zones[0].max_capacity, nr_extents, 1 << 20);
+    printf("%u,\t\t%.1f\n", nr_extents, ns);
+  }
+  return 0;
+}
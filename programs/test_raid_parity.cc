@@ -0,0 +1,59 @@
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fs/raid/zone_raid_parity.h"
+
+using namespace aquafs;
+
+// erases the chunks in lost of a generated stripe, rebuilds them and checks
+// they match what was erased
+bool check_rebuild(size_t nr_data, size_t nr_parity, size_t len,
+                   const std::vector<size_t> &lost, std::mt19937 &rng) {
+  std::vector<std::vector<char>> chunks(nr_data + nr_parity,
+                                        std::vector<char>(len));
+  for (size_t j = 0; j < nr_data; j++)
+    for (auto &c : chunks[j]) c = static_cast<char>(rng());
+  std::vector<const char *> data;
+  for (size_t j = 0; j < nr_data; j++) data.push_back(chunks[j].data());
+  parity_gen(data, len, chunks[nr_data].data(),
+             nr_parity > 1 ? chunks[nr_data + 1].data() : nullptr);
+
+  auto expected = chunks;
+  std::vector<char *> ptrs;
+  for (auto &c : chunks) ptrs.push_back(c.data());
+  for (auto c : lost) memset(ptrs[c], 0x5a, len);
+  bool ok = parity_rebuild(ptrs, nr_data, len, lost) && chunks == expected;
+
+  if (!ok) {
+    std::string erased;
+    for (auto c : lost) erased += " " + std::to_string(c);
+    fprintf(stderr, "rebuild failed: %zu data + %zu parity, len %zu, lost%s\n",
+            nr_data, nr_parity, len, erased.c_str());
+  }
+  return ok;
+}
+
+int main() {
+  std::mt19937 rng(42);
+  int failures = 0;
+  // lengths around the 16 byte lanes to cover the byte-wise tail
+  for (size_t len : {1, 15, 16, 17, 4096, 4096 + 13}) {
+    for (size_t nr_data = 1; nr_data <= 6; nr_data++) {
+      for (size_t nr_parity = 1; nr_parity <= 2; nr_parity++) {
+        auto n = nr_data + nr_parity;
+        for (size_t x = 0; x < n; x++) {
+          if (!check_rebuild(nr_data, nr_parity, len, {x}, rng)) failures++;
+          if (nr_parity < 2) continue;
+          for (size_t y = x + 1; y < n; y++)
+            if (!check_rebuild(nr_data, nr_parity, len, {x, y}, rng))
+              failures++;
+        }
+      }
+    }
+  }
+  printf("parity rebuild: %d failures\n", failures);
+  return failures == 0 ? 0 : 1;
+}